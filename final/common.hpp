@@ -5,15 +5,32 @@
 
 #ifndef __COMMON__
 #define __COMMON__
+
+// These can all be overridden from the command line (-D...), as long as the simulator and renderer get the same values
+#ifndef FFT_SIZE
 #define FFT_SIZE (1024)
-#define NUM_LEAF_LOOPERS (2)
+#endif
+// Room in the State. The simulator runs one looper per channel of the analysis soundfile, up to this many.
+// Every slot gets broadcast whether it's in use or not, so a big pool (8-16) wants COMPACT_STATE too
+#ifndef MAX_LEAF_LOOPERS
+#define MAX_LEAF_LOOPERS (2)
+#endif
+#ifndef REDUNDANCY
 #define REDUNDANCY (5)
-#define NUM_TRAIL_POINTS_PER_FRAME (5)
+#endif
+#ifndef VISUAL_DECAY
+#define VISUAL_DECAY (0.8)
+#endif
+#define NUM_TRAIL_POINTS_PER_FRAME (5)  // the default; each looper can use up to MAX_TRAIL_POINTS_PER_FRAME
+#define MAX_TRAIL_POINTS_PER_FRAME (32)
+// #define COMPACT_STATE  // broadcast quantized strips (newest one only) instead of full float ones
+#define COMPACT_POSITION_RANGE (16.0)  // compact strip vertices must lie within this distance of the looper
 
 #include <cmath>
 #include <iostream>
 #include <vector>
 #include <deque>
+#include <algorithm>
 
 #include "Cuttlebone/Cuttlebone.hpp"
 #include "allocore/al_Allocore.hpp"
@@ -26,30 +43,79 @@ struct PseudoMesh
 {
 	Vec3f vertices[MESH_SIZE];
  	Color colors[MESH_SIZE];
+
+	void set(int i, const Vec3f& v, const Color& c) {
+		vertices[i] = v;
+		colors[i] = c;
+	}
+
+	Vec3f vertex(int i) const { return vertices[i]; }
+	Color color(int i) const { return colors[i]; }
+};
+
+// Same interface as PseudoMesh, but about a third of the size: vertices are quantized to 16 bits
+// relative to the looper's Pose (strips are drawn in looper coordinates anyway), colors are RGBA8
+template <size_t MESH_SIZE>
+struct CompactPseudoMesh
+{
+	short vertices[MESH_SIZE][3];
+	unsigned char colors[MESH_SIZE][4];
+
+	void set(int i, const Vec3f& v, const Color& c) {
+		for(int j = 0; j < 3; ++j) {
+			float normalized = std::max(-1.0f, std::min(1.0f, float(v[j] / COMPACT_POSITION_RANGE)));
+			vertices[i][j] = short(std::round(normalized * 32767));
+		}
+		const float components[4] = { c.r, c.g, c.b, c.a };
+		for(int j = 0; j < 4; ++j) {
+			colors[i][j] = (unsigned char)(std::round(std::max(0.0f, std::min(1.0f, components[j])) * 255));
+		}
+	}
+
+	Vec3f vertex(int i) const {
+		return Vec3f(vertices[i][0], vertices[i][1], vertices[i][2]) * float(COMPACT_POSITION_RANGE / 32767);
+	}
+
+	Color color(int i) const {
+		return Color(colors[i][0] / 255.0, colors[i][1] / 255.0, colors[i][2] / 255.0, colors[i][3] / 255.0);
+	}
 };
 
+// A strip in a FadingMeshRing repeats its first and last vertex, so that consecutive strips
+// are joined by degenerate triangles and the whole ring draws as one triangle strip
+#define RING_VERTICES_PER_STRIP (FFT_SIZE + 2)
+
+#ifdef COMPACT_STATE
+// Only the newest strip goes out; LeafLooperData::writeHead doubles as its sequence number,
+// so a renderer that misses a broadcast skips that strip rather than catching up on it
+typedef CompactPseudoMesh<FFT_SIZE> StripPacket;
+#define STRIP_REDUNDANCY (1)
+#else
+typedef PseudoMesh<FFT_SIZE> StripPacket;
+#define STRIP_REDUNDANCY (REDUNDANCY)
+#endif
+
 struct LeafLooperData
 {
-	PseudoMesh<FFT_SIZE> latestStrips[REDUNDANCY];
-	PseudoMesh<NUM_TRAIL_POINTS_PER_FRAME> latestTrailPoints[REDUNDANCY];
+	// The redundancy window is a ring: the strip and trail points for frame f live in slot f % REDUNDANCY,
+	// so each new frame overwrites the oldest slot in place instead of shifting the whole window down
+	StripPacket latestStrips[STRIP_REDUNDANCY];
+	PseudoMesh<MAX_TRAIL_POINTS_PER_FRAME> latestTrailPoints[REDUNDANCY];  // only the first trailPointsPerFrame are used
+	unsigned writeHead = 0;  // frame number of the newest slot; the renderer reads the ring by this, not State::framenum
 
 	Pose p;
 	int maxTrailLength;
 	float trailAlphaDecayFactor;
 	bool doTrail;
+	int trailPointsPerFrame;
+	float visualDecay;
 
-	void shiftStrips() {
-		// not efficient, but simple
-		for(int i = 0; i < REDUNDANCY - 1; ++i) {
-			latestStrips[i] = latestStrips[i+1];
-		}
+	StripPacket& stripForFrame(unsigned frame) {
+		return latestStrips[frame % STRIP_REDUNDANCY];
 	}
 
-	void shiftTrail() {
-		// not efficient, but simple
-		for(int i = 0; i < REDUNDANCY - 1; ++i) {
-			latestTrailPoints[i] = latestTrailPoints[i+1];
-		}
+	PseudoMesh<MAX_TRAIL_POINTS_PER_FRAME>& trailPointsForFrame(unsigned frame) {
+		return latestTrailPoints[frame % REDUNDANCY];
 	}
 };
 
@@ -57,7 +123,8 @@ struct State {
   unsigned framenum = 0;
   Pose navPose;
   Color bgColor;
-  LeafLooperData llDatas[NUM_LEAF_LOOPERS];
+  int numLoopers = 0;  // how many of the llDatas are in use
+  LeafLooperData llDatas[MAX_LEAF_LOOPERS];
 
   State() : bgColor(0, 0, 0) {}
 };
@@ -0,0 +1,24 @@
+#! /usr/local/bin/python3
+
+# converts the one-number-per-line data files (downbeats, leaf displacements) into the binary .bin files
+# that loadFloats in utilityFunctions.hpp memory maps instead of parsing the text:
+# "LLFA", a uint32 version, a uint64 count, then that many float32s, all little endian
+# usage: convertDataFiles.py [file.txt ...]   (defaults to every .txt file in this directory)
+
+import glob
+import os
+import struct
+import sys
+
+FLOAT_DATA_VERSION = 1
+
+paths = sys.argv[1:] or sorted(glob.glob(os.path.join(os.path.dirname(os.path.abspath(__file__)), "*.txt")))
+
+for path in paths:
+    with open(path) as f:
+        values = [float(line) for line in f if line.strip() != ""]
+    with open(os.path.splitext(path)[0] + ".bin", "wb") as f:
+        f.write(b"LLFA")
+        f.write(struct.pack("<IQ", FLOAT_DATA_VERSION, len(values)))
+        f.write(struct.pack("<%df" % len(values), *values))
+    print("%s: %d values" % (path, len(values)))
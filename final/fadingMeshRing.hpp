@@ -0,0 +1,208 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Fading Mesh Ring
+  A preallocated vertex buffer that lives on the GPU and holds the most recent vertices of a mesh as a circular region.
+  Each vertex remembers the frame it was born on, and the shader fades it out by decay^age, so nothing already
+  uploaded ever has to be rewritten.
+*/
+
+#ifndef __FADING_MESH_RING__
+#define __FADING_MESH_RING__
+
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+#include "allocore/al_Allocore.hpp"
+
+#define SEAM_VERTICES (2)  // a triangle strip needs the two vertices before each one
+
+using namespace al;
+
+// Plain floats rather than Vec3f and Color, so the layout is standard and offsetof is good for the attribute pointers
+struct FadingVertex {
+  float position[3];
+  float color[4];
+  float birthFrame;
+};
+
+// The simulator projects with the fixed function matrices; the renderer passes omni().glsl() as the preamble and
+// "omni_render" as the projection
+inline std::string fadingVertexCode(std::string preamble = "", std::string projection = "gl_ProjectionMatrix *") {
+  return preamble + R"(
+    uniform float frame;
+    uniform float decay;
+    varying vec4 color;
+    void main() {
+      color = gl_Color;
+      color.a *= pow(decay, frame - gl_MultiTexCoord0.x);
+      gl_Position = )" + projection + R"((gl_ModelViewMatrix * gl_Vertex);
+    }
+  )";
+}
+
+// How many frames it takes decay^age to drop below what an 8 bit framebuffer can show
+inline unsigned framesUntilInvisible(float decay) {
+  if(decay >= 1) { return -1; }  // never
+  return unsigned(ceil(log(1.0 / 255) / log(decay)));
+}
+
+inline std::string fadingFragmentCode() {
+  return R"(
+    varying vec4 color;
+    void main() {
+      gl_FragColor = color;
+    }
+  )";
+}
+
+class FadingMeshRing {
+  public:
+    FadingMeshRing() {}
+
+    ~FadingMeshRing() {
+      if(vbo) { glDeleteBuffers(1, &vbo); }
+    }
+
+    // we own the buffer, so a copy would delete it out from under us
+    FadingMeshRing(const FadingMeshRing&) = delete;
+    FadingMeshRing& operator=(const FadingMeshRing&) = delete;
+
+    void primitive(GLenum p) { prim = p; }
+
+    // capacity is in vertices. Changing it throws away everything in the ring
+    void setCapacity(int _capacity) {
+      if(_capacity == capacity) { return; }
+      capacity = _capacity;
+      pending.clear();
+      segments.clear();
+      totalPushed = totalUploaded = 0;
+      reallocate = true;
+    }
+
+    int size() const { return int(std::min(totalPushed, (long long)capacity)); }
+
+    // Marks the vertices pushed from now on as one segment (e.g. a strip) born on birthFrame,
+    // so that draw() can skip whole segments that have faded out
+    void beginSegment(unsigned birthFrame) {
+      segments.push_back({ totalPushed, birthFrame });
+      while(segments.size() > 1 && segments.at(1).firstVertex <= totalPushed - capacity) {
+        segments.pop_front();
+      }
+    }
+
+    void push(const Vec3f& position, const Color& color, unsigned birthFrame) {
+      size_t excess = std::max(1, capacity / 4);
+      if(pending.size() == size_t(capacity) + excess) {
+        // nobody has drawn us in a while; only the newest ring's worth would survive the upload anyway
+        pending.erase(pending.begin(), pending.begin() + excess);
+        totalUploaded += excess;
+      }
+      pending.push_back({ { position.x, position.y, position.z }, { color.r, color.g, color.b, color.a }, float(birthFrame) });
+      totalPushed++;
+    }
+
+    // For running without a GL context, where nothing ever draws (frameBenchmark): counts everything pending as
+    // uploaded, so it doesn't pile up
+    void skipUpload() {
+      totalUploaded = totalPushed;
+      pending.clear();
+    }
+
+    // Draws the ring (in two calls if it wraps around the end of the buffer), leaving out the segments older than maxAge frames. Must be called with a GL context,
+    // since this is where the buffer gets created and the vertices pushed since the last draw get uploaded.
+    // Whatever shader was bound before (e.g. the omni shader on the renderer) is bound again afterwards.
+    void draw(ShaderProgram& shader, unsigned frame, float decay, unsigned maxAge = -1) {
+      upload();
+      int count = segments.empty() ? size() : 0;
+      for(const Segment& segment : segments) {
+        if(frame - segment.birthFrame <= maxAge) {
+          count = int(std::min((long long)size(), totalPushed - segment.firstVertex));
+          break;
+        }
+      }
+      if(count == 0) { return; }
+
+      GLint previousProgram;
+      glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+      shader.begin();
+      shader.uniform("frame", float(frame));
+      shader.uniform("decay", decay);
+      drawArrays(count);
+      glUseProgram(previousProgram);
+    }
+
+  private:
+    struct Segment {
+      long long firstVertex;
+      unsigned birthFrame;
+    };
+
+    GLenum prim = GL_TRIANGLE_STRIP;
+    GLuint vbo = 0;
+    bool reallocate = false;  // the buffer needs (re)allocating at the new capacity
+    int capacity = 0;
+    long long totalPushed = 0;
+    long long totalUploaded = 0;
+    std::vector<FadingVertex> pending;
+    std::deque<Segment> segments;
+
+    // Every vertex goes in once, at slot i % capacity. The first SEAM_VERTICES slots are also kept just past the end,
+    // so the triangles that join the end of the buffer to its start still get drawn when the ring wraps
+    void upload() {
+      if(!vbo) { glGenBuffers(1, &vbo); }
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      if(reallocate) {
+        glBufferData(GL_ARRAY_BUFFER, (capacity + SEAM_VERTICES) * sizeof(FadingVertex), NULL, GL_DYNAMIC_DRAW);
+        reallocate = false;
+      }
+
+      // if we fell more than a whole ring behind, the oldest pending vertices were overwritten anyway
+      size_t skip = pending.size() > size_t(capacity) ? pending.size() - capacity : 0;
+      long long index = totalUploaded + skip;
+      for(size_t i = skip; i < pending.size();) {
+        int slot = int(index % capacity);
+        int run = int(std::min(pending.size() - i, size_t(capacity - slot)));
+        glBufferSubData(GL_ARRAY_BUFFER, slot * sizeof(FadingVertex), run * sizeof(FadingVertex), &pending[i]);
+        if(slot < SEAM_VERTICES) {
+          int seamRun = std::min(run, SEAM_VERTICES - slot);
+          glBufferSubData(GL_ARRAY_BUFFER, (capacity + slot) * sizeof(FadingVertex), seamRun * sizeof(FadingVertex), &pending[i]);
+        }
+        i += run;
+        index += run;
+      }
+      totalUploaded = totalPushed;
+      pending.clear();
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draws the newest count vertices: one range if they don't wrap, otherwise the part up to the end of the buffer
+    // (running on into the seam copies) and then the part from the start
+    void drawArrays(int count) {
+      const GLsizei stride = sizeof(FadingVertex);
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_COLOR_ARRAY);
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)offsetof(FadingVertex, position));
+      glColorPointer(4, GL_FLOAT, stride, (const GLvoid*)offsetof(FadingVertex, color));
+      glTexCoordPointer(1, GL_FLOAT, stride, (const GLvoid*)offsetof(FadingVertex, birthFrame));
+
+      int first = int((totalPushed - count) % capacity);
+      int wrapped = first + count - capacity;
+      if(wrapped <= 0) {
+        glDrawArrays(prim, first, count);
+      } else {
+        glDrawArrays(prim, first, capacity - first + std::min(wrapped, SEAM_VERTICES));
+        glDrawArrays(prim, 0, wrapped);
+      }
+
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+      glDisableClientState(GL_COLOR_ARRAY);
+      glDisableClientState(GL_VERTEX_ARRAY);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
+#endif
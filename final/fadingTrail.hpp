@@ -0,0 +1,71 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Fading Trail
+  The trail a leaf looper leaves behind: a triangle strip joining each frame's trail points to the previous frame's.
+  Each frame only appends its own segment to a FadingMeshRing and the fade comes from the points' age,
+  so keeping up the trail costs the same no matter how long it is.
+*/
+
+#ifndef __FADING_TRAIL__
+#define __FADING_TRAIL__
+
+#include "fadingMeshRing.hpp"
+#include "common.hpp"
+
+#define MAX_TRAIL_SECONDS (60)
+#define TRAIL_FRAMES_PER_SECOND (40)  // what the trail length in seconds assumes
+
+class FadingTrail {
+  public:
+    FadingTrail() {
+      ring.primitive(GL_TRIANGLE_STRIP);
+      setPointsPerFrame(1);
+    }
+
+    // Changing the number of points per frame throws away the trail so far, since the strip joins
+    // each point to the one that many points later
+    void setPointsPerFrame(int k) {
+      if(k == pointsPerFrame) { return; }
+      pointsPerFrame = k;
+      havePreviousPoints = false;
+      // each point shows up twice in the strip, once with the point before it and once with the one after
+      ring.setCapacity(2 * MAX_TRAIL_SECONDS * TRAIL_FRAMES_PER_SECOND * pointsPerFrame);
+    }
+
+    // maxLength is in points, like LeafLooper::maxTrailLength
+    void setMaxLength(int maxLength) {
+      maxFrames = std::min(maxLength / pointsPerFrame, MAX_TRAIL_SECONDS * TRAIL_FRAMES_PER_SECOND);
+    }
+
+    void push(const Vec3f* vertices, const Color* colors, unsigned frame) {
+      if(havePreviousPoints) {
+        // decay is applied once on the frame a point comes in, so it is born a frame early
+        ring.beginSegment(frame);
+        for(int i = 0; i < pointsPerFrame; ++i) {
+          ring.push(previousVertices[i], previousColors[i], frame - 2);
+          ring.push(vertices[i], colors[i], frame - 1);
+        }
+      }
+      std::copy(vertices, vertices + pointsPerFrame, previousVertices);
+      std::copy(colors, colors + pointsPerFrame, previousColors);
+      havePreviousPoints = true;
+    }
+
+    void draw(ShaderProgram& fadingShader, unsigned frame, float decay) {
+      // a segment joins two frames' points, so it goes once its older frame falls off the end
+      if(maxFrames < 2) { return; }
+      ring.draw(fadingShader, frame, decay, maxFrames - 2);
+    }
+
+    void skipUpload() { ring.skipUpload(); }
+
+  private:
+    FadingMeshRing ring;
+    int pointsPerFrame = 0;
+    int maxFrames = 0;
+    bool havePreviousPoints = false;
+    Vec3f previousVertices[MAX_TRAIL_POINTS_PER_FRAME];
+    Color previousColors[MAX_TRAIL_POINTS_PER_FRAME];
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Frame Benchmark
+  Runs the simulator's per frame pipeline (analysis, strips, motion, score, cuttlebone) from the analysis soundfile
+  with no window, audio device or network, as fast as it will go, and reports how long each stage takes.
+  The pool seeds every looper the same way every run, so numbers from before and after a change are comparable.
+  Usage: frameBenchmark [seconds of the soundfile to run through (default: all of it)]
+  Build (and run on the whole soundfile) like the simulators, from the AlloSystem root: ./run.sh mat201b/final/frameBenchmark.cpp
+*/
+
+#define ANALYSIS_SOUND_FILE_NAME ("EvansLeafLoopsDryDPA.ogg")
+#define SAMPLE_RATE (48000)
+#define FRAMES_PER_SECOND (40)  // what the simulator animates at
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+#include "Gamma/SoundFile.h"
+#include "common.hpp"
+#include "utilityFunctions.hpp"
+#include "leafOscillators.hpp"
+#include "leafLooper.hpp"
+#include "leafLooperPool.hpp"
+#include "meterMaid.hpp"
+#include "score.hpp"
+#include "llMotion.hpp"
+using namespace al;
+using namespace std;
+
+// COUNTING ALLOCATIONS
+// Only counted while countAllocations is on, so setup and reading the soundfile don't show up
+std::atomic<bool> countAllocations(false);
+std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size) {
+  if(countAllocations) { allocationCount++; }
+  void* p = malloc(size ? size : 1);
+  if(!p) { throw std::bad_alloc(); }
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// Stands in for cuttlebone::Maker, which copies the state into its own buffer and lets a thread send it out
+struct NullMaker {
+  State sent;
+  void set(const State& state) { sent = state; }
+};
+
+enum Stage { ANALYSIS, STRIPS, MOTION, SCORE, CUTTLEBONE, NUM_STAGES };
+const char* stageNames[NUM_STAGES] = { "analysis", "strips", "motion", "score", "cuttlebone" };
+
+// The parts of the simulator that run every frame, minus everything that needs a window or audio device
+struct LeafLoopsPipeline {
+  State state;
+  NullMaker maker;
+  Nav nav;
+  LeafLooperPool lls;
+  MeterMaid beatCycleLookup, hyperbeatCycleLookup, smallSectionCycleLookup, bigSectionCycleLookup;
+  LLMotion llMotion;
+  float turnSpeed = 0.001;
+  Score score;  // after llMotion and turnSpeed, since it holds on to them
+  std::vector<float> channelBlock;  // one looper's channel of the frame, deinterleaved, like SoundStreams hands them out
+
+  LeafLoopsPipeline(int numLoopers)
+    : beatCycleLookup("LeafLoopsDownbeats.txt"),
+      hyperbeatCycleLookup("LeafLoopsHyperDownbeats.txt"),
+      smallSectionCycleLookup("LeafLoopsSectionDownbeats.txt"),
+      bigSectionCycleLookup("LeafLoopsBigSectionDownbeats.txt"),
+      llMotion(smallSectionCycleLookup, bigSectionCycleLookup, 6.0, 4.5),
+      score(lls, nav, beatCycleLookup, hyperbeatCycleLookup, smallSectionCycleLookup,
+        bigSectionCycleLookup, llMotion.horizontalRadiusMul, llMotion.verticalRadiusMul, turnSpeed)
+  {
+    lls.create(numLoopers, state);
+    nav.pos(0, -3.0, 0);
+    nav.faceToward(Vec3d(0, -3.0, -1), Vec3d(0, 1, 0));
+    for(int i = 0; i < lls.size(); ++i) {
+      lls[i].p.pos(LLMotion::spreadPosition(Vec3f(0, 0, -3), i, lls.size()));
+      lls[i].p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
+    }
+  }
+
+  // samples is one frame's worth of the soundfile, interleaved, with looper i taking channel i.
+  // t is the playback time at the start of the frame
+  void doFrame(const float* samples, int numSamples, int numChannels, float t, double stageMicroseconds[NUM_STAGES]) {
+    auto start = chrono::steady_clock::now();
+    auto lap = [&](Stage stage) {
+      auto now = chrono::steady_clock::now();
+      stageMicroseconds[stage] = chrono::duration<double, micro>(now - start).count();
+      start = now;
+    };
+
+    channelBlock.resize(numSamples);
+    for(int looper = 0; looper < lls.size(); ++looper) {
+      for(int i = 0; i < numSamples; ++i) { channelBlock[i] = samples[numChannels * i + looper]; }
+      lls[looper].analyze(channelBlock.data(), numSamples);
+    }
+    lap(ANALYSIS);
+
+    float measurePhase = beatCycleLookup.getPhasePosition(t);
+    float hypermeasurePhase = hyperbeatCycleLookup.getPhasePosition(t);
+    lls.forEach([&](LeafLooper& ll, int) { ll.pushNewStrip(measurePhase, hypermeasurePhase); });
+    lap(STRIPS);
+
+    llMotion.moveLoopers(lls, t);
+    nav.turnU(turnSpeed);  // what the simulator does while turning, which is the default
+    lap(MOTION);
+
+    score.setFromTime(t);
+    lap(SCORE);
+
+    for(LeafLooper& ll : lls) { ll.updateLLData(); }
+    state.framenum++;
+    state.navPose = nav;
+    maker.set(state);
+    lap(CUTTLEBONE);
+
+    // Nothing draws here, so stand in for the upload that would have taken the new vertices. Otherwise they back up
+    // until the rings start trimming them every frame, which the simulator never does. Not timed: it's the draw's cost
+    for(LeafLooper& ll : lls) {
+      ll.radialStrips.skipUpload();
+      ll.trail.skipUpload();
+    }
+  }
+};
+
+double percentile(vector<double>& sorted, double p) {
+  if(sorted.empty()) { return 0; }
+  return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+int main(int argc, char* argv[]) {
+  gam::SoundFile soundFile(fullPathOrDie(ANALYSIS_SOUND_FILE_NAME));
+  if(!soundFile.openRead()) {
+    fprintf(stderr, "ERROR opening the analysis soundfile %s\n", ANALYSIS_SOUND_FILE_NAME);
+    return -1;
+  }
+  // one looper per channel, like the simulator
+  int numLoopers = std::min(soundFile.channels(), MAX_LEAF_LOOPERS);
+  const int samplesPerFrame = SAMPLE_RATE / FRAMES_PER_SECOND;
+  long numFrames = soundFile.frames() / samplesPerFrame;
+  if(argc > 1) { numFrames = std::min(numFrames, long(atof(argv[1]) * FRAMES_PER_SECOND)); }
+
+  // big (it holds the whole State twice over), so it goes on the heap
+  LeafLoopsPipeline* pipeline = new LeafLoopsPipeline(numLoopers);
+
+  vector<float> samples(samplesPerFrame * soundFile.channels());
+  vector<double> stageTimes[NUM_STAGES], frameTimes;
+  for(vector<double>& times : stageTimes) { times.reserve(numFrames); }
+  frameTimes.reserve(numFrames);
+  uint64_t frameAllocations = 0;
+  double totalMicroseconds = 0;
+
+  for(long frame = 0; frame < numFrames; ++frame) {
+    // the soundfile gets decoded outside of the timing; in the simulator it happens on the audio thread anyway
+    int samplesRead = soundFile.read(samples.data(), samplesPerFrame);
+    if(samplesRead <= 0) { numFrames = frame; break; }
+
+    double stageMicroseconds[NUM_STAGES];
+    allocationCount = 0;
+    countAllocations = true;
+    pipeline->doFrame(samples.data(), samplesRead, soundFile.channels(), float(frame * samplesPerFrame) / SAMPLE_RATE, stageMicroseconds);
+    countAllocations = false;
+    frameAllocations += allocationCount;
+
+    double frameMicroseconds = 0;
+    for(int stage = 0; stage < NUM_STAGES; ++stage) {
+      stageTimes[stage].push_back(stageMicroseconds[stage]);
+      frameMicroseconds += stageMicroseconds[stage];
+    }
+    frameTimes.push_back(frameMicroseconds);
+    totalMicroseconds += frameMicroseconds;
+  }
+  if(numFrames == 0) {
+    fprintf(stderr, "ERROR: no frames to run\n");
+    return -1;
+  }
+
+  printf("%ld frames (%.1f seconds of audio), %d loopers\n\n", numFrames, double(numFrames) / FRAMES_PER_SECOND, numLoopers);
+  printf("%-12s %10s %10s %10s %10s   (microseconds)\n", "stage", "p50", "p90", "p99", "max");
+  for(int stage = 0; stage <= NUM_STAGES; ++stage) {
+    vector<double>& times = stage < NUM_STAGES ? stageTimes[stage] : frameTimes;
+    std::sort(times.begin(), times.end());
+    printf("%-12s %10.1f %10.1f %10.1f %10.1f\n", stage < NUM_STAGES ? stageNames[stage] : "whole frame",
+      percentile(times, 0.5), percentile(times, 0.9), percentile(times, 0.99), times.back());
+  }
+  printf("\nallocations per frame: %.2f\n", double(frameAllocations) / numFrames);
+  // the analysis makes spectra faster than the frames use them, so most get replaced before a strip picks them up
+  uint64_t droppedSpectra = 0;
+  for(LeafLooper& ll : pipeline->lls) { droppedSpectra += ll.droppedSpectra(); }
+  printf("spectra replaced before a strip used them: %.2f per looper per frame\n", double(droppedSpectra) / numLoopers / numFrames);
+  printf("frames per second: %.1f (%.1fx real time)\n", numFrames / (totalMicroseconds * 1e-6),
+    numFrames / (totalMicroseconds * 1e-6) / FRAMES_PER_SECOND);
+
+  delete pipeline;
+  return 0;
+}
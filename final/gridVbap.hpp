@@ -0,0 +1,302 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Grid VBAP
+  VBAP over a 3D speaker layout (like the AlloSphere's 54) with the triplet search done ahead of time. Directions are
+  quantized to an octahedral grid, and each cell remembers the (one or few) speaker triplets it overlaps and their
+  inverse matrices, so the gains for any direction come out of one lookup and a 3x3 multiply or two. Gains ramp across each block
+  like RampedVbap. Like Vbap it only pans in 3D when asked to; in 2D, and for layouts with nothing above or below the
+  horizon (e.g. the stereo pair), it is just a 2D RampedVbap.
+  Like Vbap, the source's direction is turned into the listener's frame first, so the panning follows the nav around.
+*/
+
+#ifndef __GRID_VBAP__
+#define __GRID_VBAP__
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "allocore/al_Allocore.hpp"
+#include "rampedVbap.hpp"
+
+using namespace al;
+
+#define VBAP_GRID_RESOLUTION (128)  // cells along each side of the octahedral map
+#define VBAP_MAX_FACES_PER_CELL (4)  // cells where more triplets meet than this just do without the extra ones
+
+// Where direction (any length) lands on a resolution x resolution octahedral map of the sphere
+inline int octahedralCell(Vec3d direction, int resolution) {
+  double sum = std::abs(direction[0]) + std::abs(direction[1]) + std::abs(direction[2]);
+  if(sum == 0) { return 0; }  // right on top of the listener: nowhere in particular
+  double u = direction[0] / sum, v = direction[2] / sum;
+  if(direction[1] < 0) {
+    // fold the lower half out over the corners
+    double foldedU = (1 - std::abs(v)) * (u < 0 ? -1 : 1);
+    v = (1 - std::abs(u)) * (v < 0 ? -1 : 1);
+    u = foldedU;
+  }
+  int column = std::min(resolution - 1, int((u + 1) * 0.5 * resolution));
+  int row = std::min(resolution - 1, int((v + 1) * 0.5 * resolution));
+  return row * resolution + column;
+}
+
+// The (unit) direction at a point on the octahedral map, with u and v from -1 to 1
+inline Vec3d octahedralDirection(double u, double v) {
+  double y = 1 - std::abs(u) - std::abs(v);
+  if(y < 0) {
+    double unfoldedU = (1 - std::abs(v)) * (u < 0 ? -1 : 1);
+    v = (1 - std::abs(u)) * (v < 0 ? -1 : 1);
+    u = unfoldedU;
+  }
+  Vec3d direction(u, y, v);
+  return direction / direction.mag();
+}
+
+class GridVbap : public Spatializer {
+  public:
+    // maxFrames is the biggest block we expect, so that the audio thread never has to allocate
+    GridVbap(const SpeakerLayout& speakerLayout, bool is3D = false, int maxFrames = 512, int maxSources = 16)
+      : Spatializer(speakerLayout), fallback(speakerLayout, false, maxFrames, maxSources)
+    {
+      if(!is3D) { return; }
+      sources.reserve(maxSources);
+      buildGrid(speakerLayout);
+      if(!usesGrid()) {
+        std::cout << "GridVbap: the speakers don't surround the listener, so ramping plain VBAP instead" << std::endl;
+      }
+    }
+
+    // false in 2D or if the layout was flat, in which case everything goes through RampedVbap
+    bool usesGrid() const { return !cells.empty(); }
+
+    void compile(Listener& _listener) override {
+      listener = &_listener;
+      fallback.compile(_listener);
+    }
+
+    void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample) override {
+      if(!usesGrid()) {
+        fallback.perform(io, src, relpos, numFrames, frameIndex, sample);
+        return;
+      }
+      Vec3d direction = speakerFrame(relpos);
+      SourceGains& gains = gainsOf(src, direction);
+      gains = gainsAt(direction, &src);
+      for(int k = 0; k < 3; ++k) {
+        io.out(speakerChannels[gains.speakers[k]], frameIndex) += gains.gains[k] * sample;
+      }
+    }
+
+    void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float* samples) override {
+      if(!usesGrid()) {
+        fallback.perform(io, src, relpos, numFrames, samples);
+        return;
+      }
+      Vec3d direction = speakerFrame(relpos);
+      SourceGains& from = gainsOf(src, direction);
+      SourceGains to = gainsAt(direction, &src);
+
+      // every speaker either triplet uses, ramping from its old gain to its new one by the end of the block
+      int channels[6];
+      float startGains[6], endGains[6];
+      int numRamps = 0;
+      auto addRamp = [&](int speaker, float start, float end) {
+        int channel = speakerChannels[speaker];
+        for(int r = 0; r < numRamps; ++r) {
+          if(channels[r] == channel) {
+            startGains[r] += start;
+            endGains[r] += end;
+            return;
+          }
+        }
+        channels[numRamps] = channel;
+        startGains[numRamps] = start;
+        endGains[numRamps] = end;
+        numRamps++;
+      };
+      for(int k = 0; k < 3; ++k) {
+        addRamp(from.speakers[k], from.gains[k], 0);
+        addRamp(to.speakers[k], 0, to.gains[k]);
+      }
+
+      float step = 1.0f / numFrames;
+      for(int r = 0; r < numRamps; ++r) {
+        if(startGains[r] == 0 && endGains[r] == 0) { continue; }
+        float* out = io.outBuffer(channels[r]);
+        float gain = startGains[r], gainStep = (endGains[r] - startGains[r]) * step;
+        for(int i = 0; i < numFrames; ++i) {
+          gain += gainStep;
+          out[i] += gain * samples[i];
+        }
+      }
+      from = to;
+    }
+
+  private:
+    // A speaker triplet, with the rows of the inverse of the matrix whose columns are the speakers' directions:
+    // the gains for a direction are just each row dotted with it
+    struct Face {
+      int speakers[3];
+      Vec3d inverseRows[3];
+    };
+
+    struct Cell {
+      int faces[VBAP_MAX_FACES_PER_CELL];  // indices into faces
+      int numFaces = 0;
+    };
+
+    struct SourceGains {
+      const SoundSource* source;
+      int speakers[3];
+      float gains[3];
+    };
+
+    RampedVbap fallback;
+    Listener* listener = NULL;  // whose orientation the directions are relative to; set by compile
+    std::vector<int> speakerChannels;  // device channel for each speaker
+    std::vector<Face> faces;
+    std::vector<Cell> cells;  // VBAP_GRID_RESOLUTION^2 of them, or none for a flat layout
+    std::vector<SourceGains> sources;
+
+    // relpos comes in relative to the listener's position, but along the world's axes. This turns it by the listener's
+    // orientation and swaps the axes over to the speakers' (x ahead, y left, z up), exactly as Vbap::perform does
+    Vec3d speakerFrame(const Vec3d& relpos) const {
+      Vec3d turned = listener ? listener->pose().quat().rotate(relpos) : relpos;
+      return Vec3d(-turned[2], -turned[0], turned[1]);
+    }
+
+    // O(1), with direction already in the speakers' frame: look up the cell and take whichever of its triplets the direction is inside (all the gains positive),
+    // or the nearest thing to it. Then clip any negative gains and normalize the power
+    SourceGains gainsAt(const Vec3d& direction, const SoundSource* source) const {
+      const Cell& cell = cells[octahedralCell(direction, VBAP_GRID_RESOLUTION)];
+      const Face* face = &faces[cell.faces[0]];
+      double bestSmallestGain = -INFINITY;
+      for(int i = 0; i < cell.numFaces; ++i) {
+        const Face& candidate = faces[cell.faces[i]];
+        double smallestGain = smallestGainOf(candidate, direction);
+        if(smallestGain > bestSmallestGain) {
+          bestSmallestGain = smallestGain;
+          face = &candidate;
+        }
+        if(smallestGain >= 0) { break; }
+      }
+
+      SourceGains result;
+      result.source = source;
+      float power = 0;
+      for(int k = 0; k < 3; ++k) {
+        result.speakers[k] = face->speakers[k];
+        result.gains[k] = std::max(0.0, face->inverseRows[k].dot(direction));
+        power += result.gains[k] * result.gains[k];
+      }
+      float normalize = power > 0 ? 1 / std::sqrt(power) : 0;
+      for(int k = 0; k < 3; ++k) { result.gains[k] *= normalize; }
+      return result;
+    }
+
+    // A new source starts out with the gains for wherever it first turns up, so it doesn't ramp in from silence
+    SourceGains& gainsOf(const SoundSource& src, const Vec3d& startingDirection) {
+      for(SourceGains& gains : sources) {
+        if(gains.source == &src) { return gains; }
+      }
+      sources.push_back(gainsAt(startingDirection, &src));
+      return sources.back();
+    }
+
+    static double smallestGainOf(const Face& face, const Vec3d& direction) {
+      return std::min(face.inverseRows[0].dot(direction),
+        std::min(face.inverseRows[1].dot(direction), face.inverseRows[2].dot(direction)));
+    }
+
+    // Whether the great circle arcs from a to b and from c to d cross somewhere other than their ends
+    static bool arcsCross(const Vec3d& a, const Vec3d& b, const Vec3d& c, const Vec3d& d) {
+      const double epsilon = 1e-9;
+      Vec3d abNormal = cross(a, b), cdNormal = cross(c, d);
+      double cSide = abNormal.dot(c), dSide = abNormal.dot(d), aSide = cdNormal.dot(a), bSide = cdNormal.dot(b);
+      return ((cSide > epsilon && dSide < -epsilon) || (cSide < -epsilon && dSide > epsilon)) &&
+        ((aSide > epsilon && bSide < -epsilon) || (aSide < -epsilon && bSide > epsilon)) &&
+        (a + b).dot(c + d) > 0;  // and not on opposite sides of the sphere
+    }
+
+    // The faces of the speakers' convex hull are the triplets VBAP picks from. Where several speakers share a face
+    // (a ring all at one elevation closing off the top, say) the possible triplets overlap, so like VBAP usually does
+    // we keep the ones with the shortest sides and drop any that cross them
+    void buildGrid(const SpeakerLayout& speakerLayout) {
+      const std::vector<Speaker>& speakers = speakerLayout.speakers();
+      int numSpeakers = int(speakers.size());
+      std::vector<Vec3d> directions;
+      for(const Speaker& speaker : speakers) {
+        Vec3d direction = speaker.vec();
+        directions.push_back(direction / direction.mag());
+        speakerChannels.push_back(speaker.deviceChannel);
+      }
+
+      std::vector<std::pair<double, Face>> hullFaces;  // with their perimeters
+      for(int a = 0; a < numSpeakers; ++a) {
+        for(int b = a + 1; b < numSpeakers; ++b) {
+          for(int c = b + 1; c < numSpeakers; ++c) {
+            Vec3d &la = directions[a], &lb = directions[b], &lc = directions[c];
+            double determinant = la.dot(cross(lb, lc));
+            if(std::abs(determinant) < 1e-6) { continue; }  // in a plane with the listener, so no use in 3D
+            // a hull face has every other speaker on the listener's side of it
+            Vec3d normal = cross(lb - la, lc - la);
+            if(normal.dot(la) < 0) { normal = -normal; }
+            bool onHull = true;
+            for(int other = 0; other < numSpeakers && onHull; ++other) {
+              onHull = normal.dot(directions[other] - la) <= 1e-6;
+            }
+            if(!onHull) { continue; }
+            Face face;
+            face.speakers[0] = a;
+            face.speakers[1] = b;
+            face.speakers[2] = c;
+            face.inverseRows[0] = cross(lb, lc) / determinant;
+            face.inverseRows[1] = cross(lc, la) / determinant;
+            face.inverseRows[2] = cross(la, lb) / determinant;
+            hullFaces.push_back(std::make_pair((la - lb).mag() + (lb - lc).mag() + (lc - la).mag(), face));
+          }
+        }
+      }
+      if(hullFaces.empty()) { return; }
+      std::stable_sort(hullFaces.begin(), hullFaces.end(),
+        [](const std::pair<double, Face>& a, const std::pair<double, Face>& b) { return a.first < b.first; });
+      for(const auto& candidate : hullFaces) {
+        bool crosses = false;
+        for(int i = 0; i < 3 && !crosses; ++i) {
+          const Vec3d &a = directions[candidate.second.speakers[i]], &b = directions[candidate.second.speakers[(i + 1) % 3]];
+          for(int kept = 0; kept < int(faces.size()) && !crosses; ++kept) {
+            const Face& face = faces[kept];
+            for(int j = 0; j < 3 && !crosses; ++j) {
+              crosses = arcsCross(a, b, directions[face.speakers[j]], directions[face.speakers[(j + 1) % 3]]);
+            }
+          }
+        }
+        if(!crosses) { faces.push_back(candidate.second); }
+      }
+
+      // each cell gets the faces under a few points spread over it, so that cells on an edge get both sides
+      cells.resize(VBAP_GRID_RESOLUTION * VBAP_GRID_RESOLUTION);
+      for(int c = 0; c < int(cells.size()); ++c) {
+        Cell& cell = cells[c];
+        for(int sample = 0; sample < 9; ++sample) {
+          double u = ((c % VBAP_GRID_RESOLUTION) + 0.5 * (sample % 3)) / VBAP_GRID_RESOLUTION * 2 - 1;
+          double v = ((c / VBAP_GRID_RESOLUTION) + 0.5 * (sample / 3)) / VBAP_GRID_RESOLUTION * 2 - 1;
+          Vec3d direction = octahedralDirection(u, v);
+          int best = 0;
+          double bestSmallestGain = -INFINITY;
+          for(int f = 0; f < int(faces.size()); ++f) {
+            double smallestGain = smallestGainOf(faces[f], direction);
+            if(smallestGain > bestSmallestGain) {
+              bestSmallestGain = smallestGain;
+              best = f;
+            }
+          }
+          bool alreadyThere = false;
+          for(int i = 0; i < cell.numFaces; ++i) { alreadyThere = alreadyThere || cell.faces[i] == best; }
+          if(!alreadyThere && cell.numFaces < VBAP_MAX_FACES_PER_CELL) { cell.faces[cell.numFaces++] = best; }
+        }
+      }
+    }
+};
+
+#endif
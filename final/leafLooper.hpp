@@ -6,54 +6,100 @@
 #ifndef __LEAF_LOOPER__
 #define __LEAF_LOOPER__
 
+#include <map>
 #include "Gamma/DFT.h"
 #include "allocore/al_Allocore.hpp"
 #include "leafOscillators.hpp"
+#include "fadingMeshRing.hpp"
+#include "fadingTrail.hpp"
+#include "stripKernel.hpp"
+#include "tripleBuffer.hpp"
+#include "spectralCache.hpp"
 #include "common.hpp"
 
+struct Spectrum {
+  float magnitudes[FFT_SIZE/2] = {};
+};
+
+// One edge of a radial strip: a vertex and a color per bin. Each strip runs from the previous edge to the newest one
+struct StripEdge {
+  Vec3f vertices[FFT_SIZE/2];
+  Color colors[FFT_SIZE/2];
+};
+
+// Each bin's distance out along the strip, on a log frequency scale from 20Hz, with centerFrequency at 1.
+// The curve only depends on centerFrequency (and FFT_SIZE and SAMPLE_RATE), so each one is worked out once
+// and every looper shares it. Call from the graphics thread
+inline const float* normalizedBinRadii(float centerFrequency) {
+  static std::map<float, std::vector<float>> curves;  // map nodes never move, so the pointers we hand out stay good
+  std::vector<float>& curve = curves[centerFrequency];
+  if(curve.empty()) {
+    curve.resize(FFT_SIZE / 2);
+    float logLowest = log(20), scale = 1 / (log(centerFrequency) - logLowest);
+    for(int i = 0; i < FFT_SIZE / 2; i++) {
+      float freq = float(i) / FFT_SIZE * SAMPLE_RATE;
+      curve[i] = (log(freq) - logLowest) * scale;
+    }
+  }
+  return curve.data();
+}
 
 struct LeafLooper : SoundSource {
   Pose p;
   gam::STFT stft;
-  deque<Buffer<Vec3f>> radialStripVertices;
-  deque<Buffer<Color>> radialStripColors;
-  deque<Mesh> radialStrips;
+  // The only copy of the strips we keep. The newest edge lives at writeHead % 2, the one before it in the other slot,
+  // and each new strip goes straight from these into both the cuttlebone packet and radialStrips
+  StripEdge stripEdges[2];
+  FadingMeshRing radialStrips;  // all the strips back to back, each one joined to the next by degenerate triangles
 
-  Mesh trail;
-  deque<Vec3f> trailVertices;
-  deque<Color> trailColors;
+  FadingTrail trail;
   int maxTrailLength = 0;
   float trailAlphaDecayFactor = 0.99;
   bool doTrail = true;
+  int trailPointsPerFrame = NUM_TRAIL_POINTS_PER_FRAME;  // the loudest this many bins of each strip go into the trail
+  float trailLengthInSeconds = 15;
 
-  int maxStrips = 60;
+  // Strips fade by visualDecay^age at draw time, so a longer history only costs buffer space
+  int maxStrips = 300;
+  float visualDecay = VISUAL_DECAY;
 
-  LeafLooperData llData;  // The cuttlebone struct for this lil guy
+  LeafLooperData& llData;  // The cuttlebone struct for this lil guy (lives in the State, so we write it in place)
 
   float centerFrequency = 4000;
-  float centerRadius = 1;
+  float centerRadius = 1;  // how far out centerFrequency's bin sits; scales the whole strip as it's generated
 
   float amplitudeExpansion = 0.5;
 
   CombinedLeafOscillator& lfo;
-  vector<float> binRadii;
-  vector<float> fftMagnitudes;
+  const float* binRadii = NULL;  // normalizedBinRadii(centerFrequency)
+  TripleBuffer<Spectrum> spectra;  // written by the audio thread once per STFT hop, read by the graphics thread
+  const float* cachedMagnitudes = NULL;  // when set, the strips come from a precomputed spectral cache instead
 
   Color llColor;
 
+  StripKernel<FFT_SIZE/2> stripKernel;
+  LaneRandom random;
+  std::vector<int> binsByMagnitude;  // scratch for picking the trail points; always some ordering of all the bins
+  Vec3f topMagVertices[MAX_TRAIL_POINTS_PER_FRAME];
+  Color topMagColors[MAX_TRAIL_POINTS_PER_FRAME];
+
   // DEBUG
   Mesh directionCone;
   bool showDirectionCone = false;
 
-  LeafLooper(CombinedLeafOscillator& _lfo, Color _llColor) 
+  // seed picks the looper's random stream, so the same seed makes the same strips every run
+  LeafLooper(CombinedLeafOscillator& _lfo, Color _llColor, LeafLooperData& _llData, uint32_t seed) 
   : stft(
     FFT_SIZE, FFT_SIZE/4,  // Window size, hop size
     0, gam::HANN, gam::COMPLEX 
-  ), lfo(_lfo), llColor(_llColor)
+  ), llData(_llData), lfo(_lfo), llColor(_llColor), random(seed)
   {
-    fftMagnitudes.resize(FFT_SIZE/2);
+    binsByMagnitude.resize(FFT_SIZE/2);
+    std::iota(binsByMagnitude.begin(), binsByMagnitude.end(), 0);
 
-    trail.primitive(Graphics::TRIANGLE_STRIP);
+    radialStrips.primitive(Graphics::TRIANGLE_STRIP);
+    radialStrips.setCapacity(maxStrips * RING_VERTICES_PER_STRIP);
+    trail.setPointsPerFrame(trailPointsPerFrame);
 
     // DEBUG
     addCone(directionCone, 0.1, Vec3f(0, 0, -0.8));  // by default we treat objects as facing in the negative z direction
@@ -63,87 +109,111 @@ struct LeafLooper : SoundSource {
     setBinRadii(1);
   }
 
-  void setBinRadii(float centerRadius, float centerFrequency=4000) {
-    binRadii.clear();
-    for(int i = 0; i < FFT_SIZE / 2; i++) {
-      float freq = float(i) / FFT_SIZE * SAMPLE_RATE;
-      binRadii.push_back((log(freq) - log(20)) / (log(centerFrequency) - log(20)) * centerRadius);  
+  // Cheap enough to call every frame: the radius is just a scale applied as the strips are made
+  void setBinRadii(float _centerRadius, float _centerFrequency=4000) {
+    centerRadius = _centerRadius;
+    if(binRadii == NULL || _centerFrequency != centerFrequency) {
+      centerFrequency = _centerFrequency;
+      binRadii = normalizedBinRadii(centerFrequency);
     }
   }
 
   void setTrailLengthInSeconds(float seconds) {
-    maxTrailLength = seconds * 40 * NUM_TRAIL_POINTS_PER_FRAME;
-    trailAlphaDecayFactor = exp(log(0.05) * NUM_TRAIL_POINTS_PER_FRAME / maxTrailLength);
+    trailLengthInSeconds = seconds;
+    maxTrailLength = seconds * TRAIL_FRAMES_PER_SECOND * trailPointsPerFrame;
+    trailAlphaDecayFactor = exp(log(0.05) * trailPointsPerFrame / maxTrailLength);
+  }
+
+  void setTrailPointsPerFrame(int k) {
+    k = std::max(1, std::min(k, MAX_TRAIL_POINTS_PER_FRAME));
+    if(k == trailPointsPerFrame) { return; }
+    trailPointsPerFrame = k;
+    trail.setPointsPerFrame(k);
+    setTrailLengthInSeconds(trailLengthInSeconds);
   }
 
-  void draw(Graphics& g) {
+  void draw(Graphics& g, ShaderProgram& fadingShader) {
     g.blendOn();
     g.blendModeTrans();
     g.pushMatrix();
 
     g.translate(p.pos());
     g.rotate(p);
-    for(auto& radialStrip : radialStrips) {
-      g.draw(radialStrip);
-    }
+    radialStrips.draw(fadingShader, llData.writeHead, visualDecay, framesUntilInvisible(visualDecay));
     if(showDirectionCone) {
       g.draw(directionCone);
     }
     g.popMatrix();
     if(doTrail) {
-      g.draw(trail);
+      trail.setMaxLength(maxTrailLength);
+      trail.draw(fadingShader, llData.writeHead, trailAlphaDecayFactor);
     }
   }
 
+  // AUDIO THREAD
   void operator()(float s) {
-    if(stft(s)) {
-      // Loop through all the bins
-      for(unsigned k=0; k<stft.numBins(); ++k){
-        // higher pow reduces visual decay time
-        // multiplier gets it to roughly the right level
-        // tanh squashes it between 0 and 1
-        fftMagnitudes[k] = tanh(pow(stft.bin(k).mag(), 1.3) * 1000.0);
-      }
+    if(stft(s)) { publishSpectrum(); }
+  }
+
+  // AUDIO THREAD
+  // A block of n samples, same as calling operator() on each of them
+  void analyze(const float* samples, int n) {
+    for(int i = 0; i < n; ++i) {
+      if(stft(samples[i])) { publishSpectrum(); }
     }
   }
 
+  // GRAPHICS THREAD
+  // The newest complete spectrum from the audio thread. Stays the same until the next call
+  const Spectrum& latestSpectrum() {
+    spectra.update();
+    return spectra.front();
+  }
+
+  // how many spectra the audio thread published that the graphics side never got to see
+  uint64_t droppedSpectra() const { return spectra.dropped(); }
+
+  // Points the next strip at a row of a SpectralCache, in which case the audio thread doesn't need to call us at all.
+  // NULL goes back to the real time analysis
+  void useCachedSpectrum(const float* magnitudes) { cachedMagnitudes = magnitudes; }
+
+  // Copies the settings the renderer needs into our cuttlebone struct (the strips and trail points are written as they're made)
+  void updateLLData() {
+    llData.p = p;
+    llData.maxTrailLength = maxTrailLength;
+    llData.trailAlphaDecayFactor = trailAlphaDecayFactor;
+    llData.doTrail = doTrail;
+    llData.visualDecay = visualDecay;
+    llData.trailPointsPerFrame = trailPointsPerFrame;
+  }
+
   void pushNewStrip(float phase, float phase2) {
-    // ADD A NEW STRIP OF VERTICES AND COLORS
-    Buffer<Vec3f> newRadialStripVertices;
-    Buffer<Color> newRadialStripColors;
+    // every call is a new frame as far as the cuttlebone ring is concerned
+    llData.writeHead++;
 
+    const float* fftMagnitudes = cachedMagnitudes ? cachedMagnitudes : latestSpectrum().magnitudes;
+
+    // ADD A NEW STRIP OF VERTICES AND COLORS
+    // loud bins get visualized with random displacement of both angles
+    StripEdge& newEdge = stripEdges[llData.writeHead % 2];
+    stripKernel.generate(binRadii, fftMagnitudes, lfo.getRadius(phase) * centerRadius, lfo.getAngle(phase), lfo.getAngle(phase2),
+      amplitudeExpansion, random, newEdge.vertices);
     for(int i = 0; i < FFT_SIZE / 2; i++) {
-      float radius = binRadii.at(i) * lfo.getRadius(phase);
-      float angle = lfo.getAngle(phase) + rnd::uniformS() * amplitudeExpansion * fftMagnitudes.at(i);
-      float angle2 = lfo.getAngle(phase2) + rnd::uniformS() * amplitudeExpansion * fftMagnitudes.at(i);
-      // // loud bins get visualized with random displacement of the second angle
-      // float adjustedAngle2 = angle2 + rnd::uniformS() * amplitudeExpansion * fftMagnitudes.at(i); // 0.5*M_PI; 
-      // add randomness to phase 2, and clip it
-      newRadialStripVertices.append(Vec3f(cos(angle2)*radius, cos(angle)*sin(angle2)*radius, -sin(angle)*radius));
-      newRadialStripColors.append(Color(llColor.r, llColor.g, llColor.b, fftMagnitudes.at(i)));
+      newEdge.colors[i] = Color(llColor.r, llColor.g, llColor.b, fftMagnitudes[i]);
     }
-    radialStripVertices.push_back(newRadialStripVertices);
-    radialStripColors.push_back(newRadialStripColors);
     pushNewStripMesh();
 
-    std::vector<int> binsByMagnitude(fftMagnitudes.size());
-    std::iota(binsByMagnitude.begin(), binsByMagnitude.end(), 0);
-    // std::vector<float>& fftMagnitudes = this->fftMagnitudes;
-    std::sort(binsByMagnitude.begin(), binsByMagnitude.end(),
-      [&](int a, int b) {  
-        return (fftMagnitudes.at(a) > fftMagnitudes.at(b));  
-      }
-    );
-    std::vector<Vec3f> topMagVertices;
-    std::vector<Color> topMagColors;
-    for(int i = 0; i < NUM_TRAIL_POINTS_PER_FRAME; ++i) {
-      int thisBin = binsByMagnitude.at(i);
-      Vec3f& thisVertex = newRadialStripVertices[thisBin];
+    // we only need the loudest few bins, loudest first, so select them rather than sorting everything
+    auto louder = [&](int a, int b) { return fftMagnitudes[a] > fftMagnitudes[b]; };
+    std::nth_element(binsByMagnitude.begin(), binsByMagnitude.begin() + trailPointsPerFrame, binsByMagnitude.end(), louder);
+    std::sort(binsByMagnitude.begin(), binsByMagnitude.begin() + trailPointsPerFrame, louder);
+    for(int i = 0; i < trailPointsPerFrame; ++i) {
+      int thisBin = binsByMagnitude[i];
+      Vec3f& thisVertex = newEdge.vertices[thisBin];
       // need to translate the vertex to world coordinates. This was a little tricky...
-      topMagVertices.push_back(p.pos() + p.ur() * thisVertex.x + p.uu() * thisVertex.y - p.uf() * thisVertex.z);
-      Color thisColor(newRadialStripColors[thisBin]);
-      thisColor.a *= 0.2;
-      topMagColors.push_back(thisColor);
+      topMagVertices[i] = p.pos() + p.ur() * thisVertex.x + p.uu() * thisVertex.y - p.uf() * thisVertex.z;
+      topMagColors[i] = newEdge.colors[thisBin];
+      topMagColors[i].a *= 0.2;
     }
     if(doTrail) {
       pushNewTrailPoints(topMagVertices, topMagColors);
@@ -151,70 +221,45 @@ struct LeafLooper : SoundSource {
   }
 
   private:
-  void pushNewTrailPoints(std::vector<Vec3f>& newVertices, std::vector<Color>& newColors) {
-    llData.shiftTrail();
-    PseudoMesh<NUM_TRAIL_POINTS_PER_FRAME>& newestTrailPoints = llData.latestTrailPoints[REDUNDANCY-1];
-
-    for(int i=0; i < NUM_TRAIL_POINTS_PER_FRAME; ++i) {
-      trailVertices.push_back(newVertices.at(i));
-      newestTrailPoints.vertices[i] = newVertices.at(i);
-      trailColors.push_back(newColors.at(i));
-      newestTrailPoints.colors[i] = newColors.at(i);
+  // AUDIO THREAD
+  void publishSpectrum() {
+    float* fftMagnitudes = spectra.back().magnitudes;
+    // Loop through all the bins (but the Nyquist one, which we never draw)
+    for(unsigned k=0; k<FFT_SIZE/2; ++k){
+      fftMagnitudes[k] = displayMagnitude(stft.bin(k).mag());
     }
+    spectra.publish();
+  }
 
-    while(trailVertices.size() > maxTrailLength) {
-      trailVertices.pop_front();
-      trailColors.pop_front();
-    }
-
-    for (Color& c : trailColors) { c.a *= trailAlphaDecayFactor; }
-
-    trail.vertices().reset();
-    trail.colors().reset();
+  void pushNewTrailPoints(Vec3f* newVertices, Color* newColors) {
+    PseudoMesh<MAX_TRAIL_POINTS_PER_FRAME>& newestTrailPoints = llData.trailPointsForFrame(llData.writeHead);
 
-    for(int i = 0; i < trailVertices.size() - NUM_TRAIL_POINTS_PER_FRAME; ++i) { 
-      trail.vertex(trailVertices.at(i));
-      trail.color(trailColors.at(i));
-      trail.vertex(trailVertices.at(i + NUM_TRAIL_POINTS_PER_FRAME)); 
-      trail.color(trailColors.at(i + NUM_TRAIL_POINTS_PER_FRAME));
+    for(int i=0; i < trailPointsPerFrame; ++i) {
+      newestTrailPoints.vertices[i] = newVertices[i];
+      newestTrailPoints.colors[i] = newColors[i];
     }
+    trail.push(newVertices, newColors, llData.writeHead);
   }
 
   void pushNewStripMesh() {
-    // Construct a new strip mesh out of the last two sets of vertices and colors we added
-    if(radialStripVertices.size() > 1) {
-      Buffer<Vec3f>& newRadialStripVertices = radialStripVertices.at(radialStripVertices.size()-1);
-      Buffer<Color>& newRadialStripColors = radialStripColors.at(radialStripColors.size()-1);
-      Buffer<Vec3f>& lastRadialStripVertices = radialStripVertices.at(radialStripVertices.size()-2);
-      Buffer<Color>& lastRadialStripColors = radialStripColors.at(radialStripColors.size()-2);
-      Mesh radialStrip;
-
-      llData.shiftStrips();
-      PseudoMesh<FFT_SIZE>& newestPseudoStrip = llData.latestStrips[REDUNDANCY-1];
-
-      radialStrip.primitive(Graphics::TRIANGLE_STRIP);
+    // Construct a new strip out of the last two edges we made, writing it to the cuttlebone packet and the ring in one pass
+    if(llData.writeHead > 1) {
+      const StripEdge& newEdge = stripEdges[llData.writeHead % 2];
+      const StripEdge& lastEdge = stripEdges[(llData.writeHead - 1) % 2];
+
+      StripPacket& newestPseudoStrip = llData.stripForFrame(llData.writeHead);
+
+      // the trailing edge is a frame older than the leading one, so it starts out one visualDecay dimmer
+      unsigned lastBirth = llData.writeHead - 1, newBirth = llData.writeHead;
+      radialStrips.beginSegment(lastBirth);
+      radialStrips.push(lastEdge.vertices[0], lastEdge.colors[0], lastBirth);
       for(int i = 0; i < FFT_SIZE / 2; i++) {
-        radialStrip.vertex(lastRadialStripVertices[i]);
-        newestPseudoStrip.vertices[2*i] = lastRadialStripVertices[i];
-        Color lc = lastRadialStripColors[i];
-        lc.a *= VISUAL_DECAY;
-        radialStrip.color(lc);
-        newestPseudoStrip.colors[2*i] = lastRadialStripColors[i];
-        radialStrip.vertex(newRadialStripVertices[i]);
-        newestPseudoStrip.vertices[2*i + 1] = newRadialStripVertices[i];
-        radialStrip.color(newRadialStripColors[i]);
-        newestPseudoStrip.colors[2*i + 1] = newRadialStripColors[i];
+        radialStrips.push(lastEdge.vertices[i], lastEdge.colors[i], lastBirth);
+        newestPseudoStrip.set(2*i, lastEdge.vertices[i], lastEdge.colors[i]);
+        radialStrips.push(newEdge.vertices[i], newEdge.colors[i], newBirth);
+        newestPseudoStrip.set(2*i + 1, newEdge.vertices[i], newEdge.colors[i]);
       }
-      for(int i = 0; i < radialStrips.size(); ++i) {
-        for(auto& color : radialStrips.at(i).colors()) {
-          color.a *= VISUAL_DECAY;
-        }
-      }
-      radialStrips.push_back(radialStrip);
-    }
-    if(radialStrips.size() > maxStrips) {
-      radialStrips.pop_front();
-      radialStripVertices.pop_front();
+      radialStrips.push(newEdge.vertices[FFT_SIZE/2 - 1], newEdge.colors[FFT_SIZE/2 - 1], newBirth);
     }
   }
 };
@@ -0,0 +1,65 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Leaf Looper Pool
+  One leaf looper per channel of the analysis soundfile (up to MAX_LEAF_LOOPERS), each with its own oscillator,
+  its own random stream and its own slot in the State. forEach spreads the per frame work on them across the cores.
+*/
+
+#ifndef __LEAF_LOOPER_POOL__
+#define __LEAF_LOOPER_POOL__
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include "common.hpp"
+#include "leafOscillators.hpp"
+#include "leafLooper.hpp"
+#include "workerPool.hpp"
+
+// what the first two loopers have always been; more loopers alternate between them
+const Color LEAF_LOOPER_COLORS[2] = { Color(0.9375, 0.9375, 0.3125), Color(0.39375, 0.875, 0.538125) };
+
+class LeafLooperPool {
+  public:
+    LeafLooperPool() {}
+
+    // Only call once, before anything gets hold of the loopers
+    void create(int numLoopers, State& state) {
+      numLoopers = std::max(1, std::min(numLoopers, MAX_LEAF_LOOPERS));
+      if(numLoopers < MAX_LEAF_LOOPERS) {
+        // ok, but worth knowing, since the State has room for (and broadcasts) the rest regardless
+        std::cout << "Running " << numLoopers << " of " << MAX_LEAF_LOOPERS << " leaf loopers" << std::endl;
+      }
+      state.numLoopers = numLoopers;
+      for(int i = 0; i < numLoopers; ++i) {
+        oscillators.emplace_back(ivyOscillator, birchOscillator);
+        // seeded by position in the pool, so looper i looks the same every run however many loopers exist elsewhere
+        loopers.emplace_back(oscillators.back(), LEAF_LOOPER_COLORS[i % 2], state.llDatas[i], i + 1);
+      }
+      // no point in more threads than loopers
+      workerPool.start(std::min(numLoopers, std::max(1, int(std::thread::hardware_concurrency()))) - 1);
+    }
+
+    int size() const { return int(loopers.size()); }
+    LeafLooper& operator[](int i) { return loopers[i]; }
+    std::deque<LeafLooper>::iterator begin() { return loopers.begin(); }
+    std::deque<LeafLooper>::iterator end() { return loopers.end(); }
+
+    // Calls f(looper, index) for every looper, spread over the cores, and returns once they're all done.
+    // f must only touch its own looper (and things that are only read), since any number of them run at once
+    template <class F>
+    void forEach(F f) {
+      auto forLooper = [&](int i) { f(loopers[i], i); };
+      workerPool.parallelFor(size(), forLooper);
+    }
+
+  private:
+    // deques never move what's in them, which matters since the loopers hold references to their oscillators
+    std::deque<CombinedLeafOscillator> oscillators;
+    // not a vector: a LeafLooper can't be moved (it holds a reference and owns GL buffers), and vector insists on
+    // being able to move them when it grows, reserve or not. So the loopers aren't contiguous either
+    std::deque<LeafLooper> loopers;
+    WorkerPool workerPool;
+};
+
+#endif
@@ -6,70 +6,87 @@
 #ifndef __LEAF_OSCILLATORS__
 #define __LEAF_OSCILLATORS__
 
+#include <cassert>
 #include "allocore/al_Allocore.hpp"
+#include "utilityFunctions.hpp"
+#include "oscillatorTable.hpp"
 
-class LeafOscillator {
-  // LeafOscillator abstract class
-   public:
-      // pure virtual function
-      virtual float getAngle(float phase) = 0;
-      virtual float getRadius(float phase) = 0;
-};
+// One resolution for every leaf table, so a blend of two of them can be baked point by point
+#define LEAF_TABLE_SIZE (1024)
+#define LEAF_TABLE_INTERPOLATION (LINEAR)  // CUBIC is smoother, but costs twice the reads
+
+typedef OscillatorTable<LEAF_TABLE_SIZE, LEAF_TABLE_INTERPOLATION> LeafTable;
 
-struct SingleLeafOscillator : LeafOscillator {
-  std::vector<float> angles;
-  std::vector<float> radii;
-  float phaseAdjustment;
+// The shape of a leaf, as angle and distance from its center over one cycle of phase,
+// resampled from the motion capture data onto a LeafTable
+struct SingleLeafOscillator {
+  LeafTable angles;
+  LeafTable radii;
   SingleLeafOscillator(string dataFileName) {
-    std::vector<float> data;
-    ifstream input(fullPathOrDie(dataFileName));
-    for( string line; getline( input, line ); ) {
-        data.push_back(stof(line));
-    }
-    for(int i = 0; i < data.size(); i += 2) {
-      al::Vec2f displacement(data.at(i), data.at(i+1));
-      angles.push_back(atan2(displacement.y, displacement.x));
-      radii.push_back(displacement.mag());
+    FloatArray data = loadFloats(dataFileName);  // x and y displacements, alternating
+    int numPoints = data.size() / 2;
+    assert(numPoints > 0);
+    for(int i = -1; i <= LEAF_TABLE_SIZE + 1; ++i) {
+      // the displacement in between the two nearest captured points
+      float position = float(i & (LEAF_TABLE_SIZE - 1)) / LEAF_TABLE_SIZE * numPoints;
+      int point = int(position);
+      float fraction = position - point;
+      int nextPoint = (point + 1) % numPoints;
+      al::Vec2f displacement(
+        data[2*point] + (data[2*nextPoint] - data[2*point]) * fraction,
+        data[2*point + 1] + (data[2*nextPoint + 1] - data[2*point + 1]) * fraction
+      );
+      angles.set(i, atan2(displacement.y, displacement.x));
+      radii.set(i, displacement.mag());
     }
+    angles.unwrapAngles();
   }
 
-  float getAngle(float phase) {
-    return angles.at(int((phase - floor(phase)) * angles.size()));
-  }
-
-  float getRadius(float phase) {
-    return radii.at(int((phase - floor(phase)) * radii.size()));
-  }
+  float getAngle(float phase) const { return angles(phase); }
+  float getRadius(float phase) const { return radii(phase); }
 };
 
 
-struct CombinedLeafOscillator : LeafOscillator {
-  LeafOscillator& lfo1;
-  LeafOscillator& lfo2;
+// Blends two leaves. The blend only changes when the weighting does, so it gets baked into
+// tables then, and looking it up is just an interpolated read
+struct CombinedLeafOscillator {
+  const SingleLeafOscillator& lfo1;
+  const SingleLeafOscillator& lfo2;
   float weighting = 0;  // weighting of 0 means all lfo1, of 1 means all lfo2
-  CombinedLeafOscillator(LeafOscillator& _lfo1, LeafOscillator& _lfo2) :
+  CombinedLeafOscillator(const SingleLeafOscillator& _lfo1, const SingleLeafOscillator& _lfo2) :
     lfo1(_lfo1), lfo2(_lfo2) 
-  {}  
+  {
+    bakeTables();
+  }  
 
   void setWeighting(float w) {
     assert(w >= 0 && w <= 1);
+    if(w == weighting) { return; }
     weighting = w;
+    bakeTables();
   }
 
-  float getRadius(float phase) {
-    return (1 - weighting) * lfo1.getRadius(phase) + weighting * lfo2.getRadius(phase);
-  }
+  float getRadius(float phase) const { return radiusTable(phase); }
+  float getAngle(float phase) const { return angleTable(phase); }
 
-  float getAngle(float phase) {
-    // averaging angles takes a little more care, due to the cyclical nature
-    float angle1 = lfo1.getAngle(phase);
-    float angle2 = lfo2.getAngle(phase);
-    if (angle1 - angle2 > M_PI) angle2 += 2 * M_PI;
-    else if (angle2 - angle1 > M_PI) angle1 += 2 * M_PI;
-    float averageAngle = (1 - weighting) * angle1 + weighting * angle2;
-    if (averageAngle > 2 * M_PI) return averageAngle - 2 * M_PI;
-    else return averageAngle;
-  }
+  private:
+    LeafTable angleTable;
+    LeafTable radiusTable;
+
+    // both leaves are sampled at the same phases, so the blend is worked out point by point
+    void bakeTables() {
+      for(int i = -1; i <= LEAF_TABLE_SIZE + 1; ++i) {
+        radiusTable.set(i, (1 - weighting) * lfo1.radii.at(i) + weighting * lfo2.radii.at(i));
+        angleTable.set(i, blendAngles(lfo1.angles.at(i), lfo2.angles.at(i)));
+      }
+      angleTable.unwrapAngles();
+    }
+
+    float blendAngles(float angle1, float angle2) {
+      // averaging angles takes a little more care, due to the cyclical nature: go the short way around
+      angle2 -= 2 * M_PI * round((angle2 - angle1) / (2 * M_PI));
+      return (1 - weighting) * angle1 + weighting * angle2;
+    }
 };
 
 SingleLeafOscillator ivyOscillator("LeafDisplacements1.txt");
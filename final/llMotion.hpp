@@ -0,0 +1,79 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project LL Motion
+  Moves the leaf loopers around the listener, following the small and big section downbeats
+*/
+
+#ifndef __LL_MOTION__
+#define __LL_MOTION__
+
+#include "allocore/al_Allocore.hpp"
+#include "leafOscillators.hpp"
+#include "meterMaid.hpp"
+#include "leafLooperPool.hpp"
+
+using namespace al;
+
+#define MIN_DIST (5)
+
+struct LLMotion
+{
+  float horizontalRadiusMul, verticalRadiusMul;
+  MeterMaid horizonalDownbeatPhasor, verticalDownbeatPhasor;
+  CombinedLeafOscillator horizonalLeafOscillator, verticalLeafOscillator;
+
+  LLMotion(MeterMaid& _horizonalDownbeatsPhasor, MeterMaid& _verticalDownbeatsPhasor, float _horizontalRadiusMul, float _verticalRadiusMul)
+   : horizontalRadiusMul(_horizontalRadiusMul),
+   verticalRadiusMul(_verticalRadiusMul),
+   horizonalDownbeatPhasor(_horizonalDownbeatsPhasor), 
+   verticalDownbeatPhasor(_verticalDownbeatsPhasor),
+   horizonalLeafOscillator(ivyOscillator, birchOscillator),
+   verticalLeafOscillator(ivyOscillator, birchOscillator)
+  {
+    horizonalLeafOscillator.setWeighting(0.7);
+    verticalLeafOscillator.setWeighting(0.0);
+  }
+
+  Vec3f getPosition(float t) {
+    // each phasor only needs to be evaluated once per call
+    float hPhase = horizonalDownbeatPhasor.getPhasePosition(t);
+    float vPhase = verticalDownbeatPhasor.getPhasePosition(t);
+    float hAngle = horizonalLeafOscillator.getAngle(hPhase);
+    float hRadius = horizonalLeafOscillator.getRadius(hPhase);
+    float vAngle = verticalLeafOscillator.getAngle(vPhase);
+    float vRadius = verticalLeafOscillator.getRadius(vPhase);
+
+    float goalX = cos(hAngle) * hRadius * horizontalRadiusMul * (0.9 + pow(sin(hPhase*M_PI), 2));
+    float goalY = sin(vAngle) * vRadius * verticalRadiusMul * (0.9 + pow(sin(vPhase*M_PI), 2));
+    float goalZ = -sin(hAngle) * cos(vAngle) * vRadius * hRadius * verticalRadiusMul;
+    float horizontalDist = hypot(goalX, goalZ);
+    if(horizontalDist < MIN_DIST) { // ensure it doesn't get too close
+        goalX *= MIN_DIST / horizontalDist;
+        goalZ *= MIN_DIST / horizontalDist;
+    }
+    return Vec3d(goalX, goalY, goalZ);
+  }
+
+  // Where looper which of numLoopers goes, given where getPosition put the first one. They're spread evenly
+  // around the vertical axis, every other one upside down, so a pair sits opposite each other like it always has
+  static Vec3f spreadPosition(Vec3f position, int which, int numLoopers) {
+    float angle = 2 * M_PI * which / numLoopers;
+    float c = cos(angle), s = sin(angle);
+    Vec3f spread(c * position.x + s * position.z, position.y, -s * position.x + c * position.z);
+    if(which % 2 == 1) { spread.y = -spread.y; }
+    return spread;
+  }
+
+  // Once a frame: eases every looper a little further toward its spot at time t, facing the middle
+  void moveLoopers(LeafLooperPool& lls, float t) {
+    Vec3f ll1Position = getPosition(t);
+    Pose newGoal;
+    for(int i = 0; i < lls.size(); ++i) {
+      newGoal.pos(spreadPosition(ll1Position, i, lls.size()));
+      newGoal.faceToward(Vec3d(0, 0, 0));
+      lls[i].p = lls[i].p.lerp(newGoal, 0.01);
+    }
+  }
+};
+
+#endif
@@ -8,6 +8,7 @@
 #define __METER_MAID__
 
 #include "utilityFunctions.hpp"
+#include <algorithm>
 #include <cassert>
 
 
@@ -17,7 +18,7 @@ class MeterMaid {
   
   public:
     MeterMaid(std::string pathToDownbeatsFile) {
-      loadDownbeats(pathToDownbeatsFile, downbeats);
+      downbeats = loadFloats(pathToDownbeatsFile);
       assert(downbeats.size() > 0);
     }
 
@@ -25,20 +26,59 @@ class MeterMaid {
       if(t < downbeats.at(0)) { cycleNum = 0; return 0; }
       if(t >= downbeats.at(downbeats.size()-1)) { cycleNum = downbeats.size(); return 0; }
 
-      cycleNum = 0;
-      while(cycleNum < downbeats.size()) {
-        if(t >= downbeats.at(cycleNum)) {
-          cycleNum++;
-        } else {
-          break;
+      cycleNum = findCycleNum(t);
+
+      return (t - downbeats[cycleNum-1]) / (downbeats[cycleNum] - downbeats[cycleNum-1]);
+    }
+
+    // cycleNums run from 0 (before the first downbeat) to this (after the last one)
+    int numDownbeats() const { return int(downbeats.size()); }
+
+  private:
+    FloatArray downbeats;  // shared with every other MeterMaid reading the same file
+    int cursor = 1;  // the cycleNum we found last time
+
+    // Number of downbeats at or before t, for downbeats[0] <= t < downbeats.back().
+    // Time normally just creeps forward, so we resume from where we were last time and only
+    // fall back to a binary search when the time has jumped (e.g. skipping around in the soundfile)
+    int findCycleNum(float t) {
+      const int maxSteps = 4;
+      if(t >= downbeats[cursor-1]) {
+        for(int steps = 0; steps < maxSteps; ++steps) {
+          if(t < downbeats[cursor]) { return cursor; }
+          cursor++;
         }
       }
+      cursor = std::upper_bound(downbeats.begin(), downbeats.end(), t) - downbeats.begin();
+      return cursor;
+    }
+};
 
-      return (t - downbeats.at(cycleNum-1)) / (downbeats.at(cycleNum) - downbeats.at(cycleNum-1));
+// The four metrical levels the piece is organized in, from fastest to slowest
+enum MetricalLevel { BEAT, HYPERBEAT, SMALL_SECTION, BIG_SECTION, NUM_METRICAL_LEVELS };
+
+struct MetricalPosition {
+  float phases[NUM_METRICAL_LEVELS];
+  int cycleNums[NUM_METRICAL_LEVELS];
+};
+
+// Resolves all the metrical levels for one time in a single call
+class MetricalHierarchy {
+
+  public:
+    MetricalHierarchy(MeterMaid& beatCycleLookup, MeterMaid& hyperbeatCycleLookup, 
+      MeterMaid& smallSectionCycleLookup, MeterMaid& bigSectionCycleLookup)
+    : levels{ &beatCycleLookup, &hyperbeatCycleLookup, &smallSectionCycleLookup, &bigSectionCycleLookup }
+    {}
+
+    void getPosition(float t, MetricalPosition& position) {
+      for(int level = 0; level < NUM_METRICAL_LEVELS; ++level) {
+        position.phases[level] = levels[level]->getPhasePosition(t, position.cycleNums[level]);
+      }
     }
 
   private:
-    std::vector<float> downbeats;
+    MeterMaid* levels[NUM_METRICAL_LEVELS];
 };
 
 // int main() {
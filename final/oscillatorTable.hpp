@@ -0,0 +1,52 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Oscillator Table
+  A function of phase sampled at a power of two number of points over one cycle, read back with linear or
+  cubic interpolation. The table is padded on both ends, so a lookup never has to check bounds or wrap around.
+*/
+
+#ifndef __OSCILLATOR_TABLE__
+#define __OSCILLATOR_TABLE__
+
+#include <cmath>
+
+enum Interpolation { LINEAR, CUBIC };
+
+template <int RESOLUTION, Interpolation INTERPOLATION = LINEAR>
+class OscillatorTable {
+  static_assert(RESOLUTION > 0 && (RESOLUTION & (RESOLUTION - 1)) == 0, "RESOLUTION has to be a power of two");
+
+  public:
+    // Sets the value at the ith point (phase i / RESOLUTION), for i from -1 to RESOLUTION + 1.
+    // The ones past either end are the padding, and should repeat the cycle
+    void set(int i, float value) { values[i + 1] = value; }
+    float at(int i) const { return values[i + 1]; }
+
+    // For tables of angles: shifts each entry by whole turns to within pi of the one before, so interpolating
+    // goes the short way around. Only for angles that end up going through sin and cos
+    void unwrapAngles() {
+      for(int i = 1; i < RESOLUTION + 3; ++i) {
+        values[i] -= 2 * M_PI * std::round((values[i] - values[i-1]) / (2 * M_PI));
+      }
+    }
+
+    float operator()(float phase) const {
+      float position = (phase - std::floor(phase)) * RESOLUTION;
+      int whole = int(position);
+      float fraction = position - whole;
+      const float* p = values + (whole & (RESOLUTION - 1));  // p[1] is the point at or before phase
+      if(INTERPOLATION == LINEAR) {
+        return p[1] + (p[2] - p[1]) * fraction;
+      } else {
+        // Catmull-Rom through the two points either side
+        return p[1] + 0.5f * fraction * (p[2] - p[0] + fraction * (2 * p[0] - 5 * p[1] + 4 * p[2] - p[3]
+          + fraction * (3 * (p[1] - p[2]) + p[3] - p[0])));
+      }
+    }
+
+  private:
+    // values[i + 1] is the point at phase i / RESOLUTION: one point of padding before the cycle, two after
+    float values[RESOLUTION + 3];
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Ramped VBAP
+  VBAP that works out the speaker gains once per block instead of once per sample. Jumping straight to the new gains
+  at each block would zipper as the loopers move, so the gains ramp linearly from where the source was at the last
+  block to where it is now. Since VBAP is linear in its gains, that ramp is just a crossfade between a Vbap::perform
+  at the old direction and one at the new direction: two gain computations per block instead of one per sample.
+*/
+
+#ifndef __RAMPED_VBAP__
+#define __RAMPED_VBAP__
+
+#include <vector>
+#include "allocore/al_Allocore.hpp"
+
+using namespace al;
+
+class RampedVbap : public Spatializer {
+  public:
+    // maxFrames is the biggest block we expect, so that the audio thread never has to allocate
+    RampedVbap(const SpeakerLayout& speakerLayout, bool is3D = false, int maxFrames = 512, int maxSources = 16)
+      : Spatializer(speakerLayout), vbap(speakerLayout, is3D)
+    {
+      fadingOut.resize(maxFrames);
+      fadingIn.resize(maxFrames);
+      lastDirections.reserve(maxSources);
+    }
+
+    void compile(Listener& listener) override {
+      vbap.compile(listener);
+    }
+
+    // Per sample processing gets exactly what Vbap would do
+    void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample) override {
+      vbap.perform(io, src, relpos, numFrames, frameIndex, sample);
+      lastDirectionOf(src) = relpos;
+    }
+
+    void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float* samples) override {
+      Vec3d& from = lastDirectionOf(src, relpos);
+      if(from == relpos) {
+        vbap.perform(io, src, relpos, numFrames, samples);
+        return;
+      }
+      if(numFrames > int(fadingOut.size())) {
+        // only if the block size changed under us
+        fadingOut.resize(numFrames);
+        fadingIn.resize(numFrames);
+      }
+      // reaching the new gains on the last frame of the block, so the next block carries on from exactly there
+      float step = 1.0f / numFrames;
+      for(int i = 0; i < numFrames; ++i) {
+        float amount = (i + 1) * step;
+        fadingIn[i] = samples[i] * amount;
+        fadingOut[i] = samples[i] - fadingIn[i];
+      }
+      Vec3d to = relpos;  // perform takes the direction by reference, so keep our own copies
+      vbap.perform(io, src, from, numFrames, fadingOut.data());
+      vbap.perform(io, src, to, numFrames, fadingIn.data());
+      from = relpos;
+    }
+
+  private:
+    Vbap vbap;
+    std::vector<float> fadingOut, fadingIn;
+    std::vector<std::pair<const SoundSource*, Vec3d>> lastDirections;  // where each source was at the end of its last block
+
+    // A new source starts out wherever it first turns up, so it doesn't ramp in from nowhere
+    Vec3d& lastDirectionOf(const SoundSource& src, const Vec3d& startingDirection = Vec3d()) {
+      for(auto& sourceAndDirection : lastDirections) {
+        if(sourceAndDirection.first == &src) { return sourceAndDirection.second; }
+      }
+      lastDirections.push_back(std::make_pair(&src, startingDirection));
+      return lastDirections.back().second;
+    }
+};
+
+#endif
@@ -3,138 +3,133 @@
   Final Project Renderer
 */
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <fstream>
 
 #include "common.hpp"
+#include "fadingMeshRing.hpp"
+#include "fadingTrail.hpp"
 #include "alloutil/al_OmniStereoGraphicsRenderer.hpp"
 
 using namespace al;
 using namespace std;
 
-#define FFT_SIZE (1024)
-#define NUM_LEAF_LOOPERS (2)
-#define REDUNDANCY (5)
-
-#define VISUAL_DECAY (0.8)
-
 
 struct LeafLooper {
   Pose p;
-  deque<Mesh> radialStrips;
-  int maxStrips = 60;
+  FadingMeshRing radialStrips;
+  int maxStrips = 300;
+  float visualDecay = VISUAL_DECAY;
 
-  Mesh trail;
-  deque<Vec3f> trailVertices;
-  deque<Color> trailColors;
+  FadingTrail trail;
   int maxTrailLength;
   float trailAlphaDecayFactor;
   bool doTrail;
+  int trailPointsPerFrame = NUM_TRAIL_POINTS_PER_FRAME;
 
   Color llColor;
+  unsigned writeHead = 0;  // the newest of the simulator's frames for this looper that we've applied
 
-  LeafLooper() {}
-
-  void pushNewStrip(Mesh strip) {
-    radialStrips.push_back(strip);
-    if(radialStrips.size() > maxStrips) {
-      radialStrips.pop_front();
-    }
-    for(auto& radialStrip : radialStrips) {
-      for(auto& color : radialStrip.colors()) {
-        color.a *= VISUAL_DECAY;
-      }
-    }
-    trail.primitive(Graphics::TRIANGLE_STRIP);
+  LeafLooper() {
+    radialStrips.primitive(Graphics::TRIANGLE_STRIP);
+    radialStrips.setCapacity(maxStrips * RING_VERTICES_PER_STRIP);
+    trail.setPointsPerFrame(trailPointsPerFrame);
   }
 
-  void pushNewTrailPoints(PseudoMesh<NUM_TRAIL_POINTS_PER_FRAME>& newTrailPoints) {
-    for(int i=0; i < NUM_TRAIL_POINTS_PER_FRAME; ++i) {
-      trailVertices.push_back(newTrailPoints.vertices[i]);
-      trailColors.push_back(newTrailPoints.colors[i]);
-    }
-
-    while(trailVertices.size() > maxTrailLength) {
-      trailVertices.pop_front();
-      trailColors.pop_front();
+  void pushNewStrip(StripPacket& strip, unsigned frame) {
+    // even vertices are the strip's trailing edge, which is a frame older than the leading edge
+    radialStrips.beginSegment(frame - 1);
+    radialStrips.push(strip.vertex(0), strip.color(0), frame - 1);
+    for(int i = 0; i < FFT_SIZE; ++i) {
+      radialStrips.push(strip.vertex(i), strip.color(i), i % 2 == 0 ? frame - 1 : frame);
     }
+    radialStrips.push(strip.vertex(FFT_SIZE - 1), strip.color(FFT_SIZE - 1), frame);
+  }
 
-    for (Color& c : trailColors) { c.a *= trailAlphaDecayFactor; }
+  void setTrailPointsPerFrame(int k) {
+    trailPointsPerFrame = k;
+    trail.setPointsPerFrame(k);
+  }
 
-    trail.vertices().reset();
-    trail.colors().reset();
+  void pushNewTrailPoints(PseudoMesh<MAX_TRAIL_POINTS_PER_FRAME>& newTrailPoints, unsigned frame) {
+    trail.push(newTrailPoints.vertices, newTrailPoints.colors, frame);
+  }
 
-    for(int i = 0; i < trailVertices.size() - NUM_TRAIL_POINTS_PER_FRAME; ++i) { 
-      trail.vertex(trailVertices.at(i));
-      trail.color(trailColors.at(i));
-      trail.vertex(trailVertices.at(i + NUM_TRAIL_POINTS_PER_FRAME)); 
-      trail.color(trailColors.at(i + NUM_TRAIL_POINTS_PER_FRAME));
+  // Applies whatever llData has that we haven't, up to its writeHead. The slots are indexed by the looper's own
+  // writeHead rather than the state's framenum, since a looper that skips a push leaves its slots where they were.
+  // However far behind we are, only the newest REDUNDANCY frames are still there. The settings only matter as of the
+  // newest frame, and the strips and trail points are pushed with their own birth frames, so they fade as if they had
+  // come in on time
+  void catchUp(LeafLooperData& llData) {
+    p = llData.p;
+    maxTrailLength = llData.maxTrailLength;
+    trailAlphaDecayFactor = llData.trailAlphaDecayFactor;
+    doTrail = llData.doTrail;
+    visualDecay = llData.visualDecay;
+    setTrailPointsPerFrame(llData.trailPointsPerFrame);
+
+    unsigned lastFrame = llData.writeHead;
+    if(lastFrame == writeHead) { return; }
+    unsigned firstFrame = lastFrame + 1 - std::min(lastFrame - writeHead, unsigned(REDUNDANCY));
+    for(unsigned frame = firstFrame; frame <= lastFrame; ++frame) {
+      // compact states only carry the newest strip
+      if(lastFrame - frame < STRIP_REDUNDANCY) {
+        pushNewStrip(llData.stripForFrame(frame), frame);
+      }
+      pushNewTrailPoints(llData.trailPointsForFrame(frame), frame);
     }
+    writeHead = lastFrame;
   }
 
-  void draw(Graphics& g) {
+  // Everything fades by its age in the looper's own frames, like the simulator draws it
+  void draw(Graphics& g, ShaderProgram& fadingShader) {
     g.pushMatrix();
     g.blendOn();
     g.blendModeTrans();
     g.translate(p.pos());
     g.rotate(p);
-    for(auto& radialStrip : radialStrips) {
-      g.draw(radialStrip);
-    }
+    radialStrips.draw(fadingShader, writeHead, visualDecay, framesUntilInvisible(visualDecay));
     g.popMatrix();
     if(doTrail) {
-      g.draw(trail);
+      trail.setMaxLength(maxTrailLength);
+      trail.draw(fadingShader, writeHead, trailAlphaDecayFactor);
     }
   }
 };
 
 class LeafLoops : public OmniStereoGraphicsRenderer {
 public:
-  LeafLooper lls[NUM_LEAF_LOOPERS];
+  LeafLooper lls[MAX_LEAF_LOOPERS];  // the simulator decides how many of these are in use (state.numLoopers)
   State state;
   cuttlebone::Taker<State> taker;
   unsigned framenum = 0;
+  ShaderProgram fadingShader;  // fades the leaf loopers' strips by their age
+  bool fadingShaderCompiled = false;
 
   LeafLoops() {
     initWindow(Window::Dim(900, 600), "Leaf Loops");
     pose.pos(0, 0, 0);
     pose.faceToward(Vec3d(0, 0, -1), Vec3d(0, 1, 0));
-    lls[0].p.pos(-1, 0, -7);
-    lls[0].p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
-    lls[1].p.pos(1, 0, -7);
-    lls[1].p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
+    for(int i = 0; i < MAX_LEAF_LOOPERS; ++i) {
+      lls[i].p.pos(2 * i - 1, 0, -7);
+      lls[i].p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
+    }
   }
 
   void onAnimate(double dt) override {
     taker.get(state);
     pose.set(state.navPose);
     omni().clearColor() = state.bgColor;
-    for(; framenum < state.framenum; framenum++) {
-      for(int whichlooper=0; whichlooper < NUM_LEAF_LOOPERS; ++whichlooper) {
-        LeafLooperData& llData = state.llDatas[whichlooper];
-        lls[whichlooper].p = llData.p;
-        lls[whichlooper].maxTrailLength = llData.maxTrailLength;
-        lls[whichlooper].trailAlphaDecayFactor = llData.trailAlphaDecayFactor;
-        lls[whichlooper].doTrail = llData.doTrail;
-
-        if(state.framenum - framenum <= REDUNDANCY) {
-          PseudoMesh<FFT_SIZE>& thisStrip = llData.latestStrips[REDUNDANCY - (state.framenum - framenum)];
-          
-          Mesh newStrip;
-          newStrip.primitive(Graphics::TRIANGLE_STRIP);
-          for(int i = 0; i < FFT_SIZE; ++i) {
-            newStrip.vertex(thisStrip.vertices[i]);
-            newStrip.color(thisStrip.colors[i]);
-          }
-          lls[whichlooper].pushNewStrip(newStrip);
-        }
-        if(state.framenum - framenum <= REDUNDANCY) {
-          PseudoMesh<NUM_TRAIL_POINTS_PER_FRAME>& theseTrailPoints = llData.latestTrailPoints[REDUNDANCY - (state.framenum - framenum)];
-          lls[whichlooper].pushNewTrailPoints(theseTrailPoints);
-        }
-      }
+    if(framenum >= state.framenum) { return; }
+
+    // Everything fades by its age when drawn, so the frames we missed don't need visiting: each looper applies
+    // what's left in one batch and jumps straight to its newest frame
+    for(int whichlooper=0; whichlooper < state.numLoopers; ++whichlooper) {
+      lls[whichlooper].catchUp(state.llDatas[whichlooper]);
     }
+    framenum = state.framenum;
   }
 
   void onDraw(Graphics& g) override {
@@ -142,8 +137,18 @@ public:
     // shader().uniform("texture", 1.0);
     // shader().uniform("lighting", 1.0);
     //
-    for(LeafLooper& ll : lls) {
-      ll.draw(g);
+    if(!fadingShaderCompiled) {
+      fadingShader.compile(fadingVertexCode(omni().glsl(), "omni_render"), fadingFragmentCode());
+      fadingShaderCompiled = true;
+    }
+    // the omni uniforms change with every face and eye, and stay with the program until we set them again
+    fadingShader.begin();
+    omni().uniforms(fadingShader);
+    fadingShader.end();
+    shader().begin();
+
+    for(int whichlooper=0; whichlooper < state.numLoopers; ++whichlooper) {
+      lls[whichlooper].draw(g, fadingShader);
     }
   }
 };
@@ -1,87 +1,88 @@
 /*
   Marc Evans (2018/3/8)
   Final Project Score
-  A class for keeping track of the position within a bar or higher lever metrical structure
+  Drives the leaf loopers, listener and motion through the piece. The section by section changes are compiled
+  into a timeline up front; each frame just finds where we are in it.
 */
 
 #ifndef __SCORE__
 #define __SCORE__
 
 #include <cassert>
-#include "leafLooper.hpp"
+#include "leafLooperPool.hpp"
+#include "meterMaid.hpp"
 
 
+// What happens over one big section of the piece. Ramps go from [0] at the section's downbeat to [1] at the next one
+struct SectionCue {
+  Color evenColors[2], oddColors[2];  // the even loopers take the first color and the odd ones the second
+  bool rampsColors = false;
+  float trailSeconds = 15;
+  bool clearsTrail = false;  // for the first few frames of the section, after a big juncture
+  bool movesNav = false;
+  float navHeights[2];
+
+  void holdColors(Color even, Color odd) {
+    evenColors[0] = evenColors[1] = even;
+    oddColors[0] = oddColors[1] = odd;
+    rampsColors = false;
+  }
+
+  void rampColors(Color evenFrom, Color evenTo, Color oddFrom, Color oddTo) {
+    evenColors[0] = evenFrom; evenColors[1] = evenTo;
+    oddColors[0] = oddFrom; oddColors[1] = oddTo;
+    rampsColors = true;
+  }
+
+  void rampNavHeight(float from, float to) {
+    navHeights[0] = from;
+    navHeights[1] = to;
+    movesNav = true;
+  }
+};
+
+inline Color lerpColor(const Color& from, const Color& to, float amount) {
+  return Color(from.r + (to.r - from.r) * amount, from.g + (to.g - from.g) * amount, from.b + (to.b - from.b) * amount);
+}
+
 class Score {
   
   public:
-    Score(LeafLooper& _ll1, LeafLooper& _ll2, Nav& _nav, MeterMaid& _beatCycleLookup, MeterMaid& _hyperbeatCycleLookup, 
+    Score(LeafLooperPool& _lls, Nav& _nav, MeterMaid& _beatCycleLookup, MeterMaid& _hyperbeatCycleLookup, 
       MeterMaid& _smallSectionCycleLookup, MeterMaid& _bigSectionCycleLookup, float& _horizontalMotionRadius, float& _verticalMotionRadius, float& _turnSpeed) 
-    : ll1(_ll1), ll2(_ll2), nav(_nav), 
-      horizontalMotionRadius(_horizontalMotionRadius), verticalMotionRadius(_verticalMotionRadius),
+    : lls(_lls),
       beatCycleLookup(_beatCycleLookup), hyperbeatCycleLookup(_hyperbeatCycleLookup), 
       smallSectionCycleLookup(_smallSectionCycleLookup), bigSectionCycleLookup(_bigSectionCycleLookup),
-      turnSpeed(_turnSpeed)
-    {}
+      metricalHierarchy(_beatCycleLookup, _hyperbeatCycleLookup, _smallSectionCycleLookup, _bigSectionCycleLookup),
+      horizontalMotionRadius(_horizontalMotionRadius), verticalMotionRadius(_verticalMotionRadius),
+      turnSpeed(_turnSpeed), nav(_nav)
+    {
+      compileTimeline();
+    }
 
     void setFromTime(float t) {
       setBeatsAndPhases(t);
-      setColors(t);
-      setTrailLength(t);
+      const SectionCue& cue = timeline[std::max(0, std::min(bigSectionNum, int(timeline.size()) - 1))];
+      setColors(cue);
+      setTrailLength(cue);
       setRadiusMul();
-      setPosition(t);
+      setPosition(cue);
+      appliedSection = bigSectionNum;
     }
 
-    void setColors(float t) {
-      switch(bigSectionNum)
-      {
-        default:
-          ll1.llColor = Color(0.9375, 0.9375, 0.3125);
-          ll2.llColor = Color(0.39375, 0.875, 0.538125);
-          break;
-        case 2:
-          ll1.llColor = Color(0.9375, 0.5, 0.3125);
-          ll2.llColor = Color(0.8375, 0.7, 0.1125);
-          break;
-        case 3:
-          ll1.llColor = Color(0, 0.979167, 0.391667);
-          ll2.llColor = Color(0.9375, 0.907812, 0.640625);
-          break;
-        case 4:
-          ll1.llColor = Color(0.9375, 0.9375, 0.3125);
-          ll2.llColor = Color(0.39375, 0.875, 0.538125);
-          break;
-        case 5:
-          ll1.llColor = Color(0.9375, 0.5, 0.3125);
-          ll2.llColor = Color(0.8375, 0.7, 0.1125);
-          break;
-        case 6:
-          ll1.llColor = Color(0.9375 * (1-bigSectionPhase), 0.5 * (1-bigSectionPhase) + 0.685416 * bigSectionPhase, 0.3125 * (1-bigSectionPhase) + 0.979167 * bigSectionPhase);
-          ll2.llColor = Color(0.8375 * (1-bigSectionPhase) + 0.7 * bigSectionPhase, 0.7 * (1-bigSectionPhase), 0.1125 * (1-bigSectionPhase) + 1.0 * bigSectionPhase);
-          break;
-        case 7:
-          ll1.llColor = Color(0.979167 * bigSectionPhase, 0.685416 * (1-bigSectionPhase) + 0.0979166 * bigSectionPhase, 0.979167 * (1-bigSectionPhase));
-          ll2.llColor = Color(0.7 + 0.3 * bigSectionPhase, 0.47 * bigSectionPhase, 1.0 * (1-bigSectionPhase) + 0.116667 * bigSectionPhase);
-          break;
-        case 8:
-          ll1.llColor = Color(0.979167, 0.0979166, 0);
-          ll2.llColor = Color(1, 0.47, 0.116667);
-          break;
-        case 9:
-          ll1.llColor = Color(0.9375, 0.5, 0.3125);
-          ll2.llColor = Color(0.9375, 0.5, 0.3125);
-          break;
+    void setColors(const SectionCue& cue) {
+      // colors that hold still for the whole section only need setting when we get there
+      if(!cue.rampsColors && bigSectionNum == appliedSection) { return; }
+      Color evenColor = lerpColor(cue.evenColors[0], cue.evenColors[1], bigSectionPhase);
+      Color oddColor = lerpColor(cue.oddColors[0], cue.oddColors[1], bigSectionPhase);
+      for(int i = 0; i < lls.size(); ++i) {
+        lls[i].llColor = i % 2 == 0 ? evenColor : oddColor;
       }
     }
 
-    void setPosition(float t) {
-      switch(bigSectionNum)
-      {
-        case 6:
-          nav.pos(nav.x(), -3.0 - 7 * bigSectionPhase, nav.z());
-          break;
-        case 7:
-          nav.pos(nav.x(), -10.0 + 7 * bigSectionPhase, nav.z());
-          break;
+    void setPosition(const SectionCue& cue) {
+      if(cue.movesNav) {
+        nav.pos(nav.x(), cue.navHeights[0] + (cue.navHeights[1] - cue.navHeights[0]) * bigSectionPhase, nav.z());
       }
     }
 
@@ -91,44 +92,34 @@ class Score {
       horizontalMotionRadius = 6.5 * (1.1 + bigDownbeatiness/3);
       verticalMotionRadius = 8.0 * (1.1 + smallDownbeatiness/3);
       float amplitudeExpansion = 0.5;
-      ll1.amplitudeExpansion = amplitudeExpansion;
-      ll2.amplitudeExpansion = amplitudeExpansion;
-      ll1.setBinRadii(1 + (1 - bigDownbeatiness)*2.5 + (1 - smallDownbeatiness));
-      ll2.setBinRadii(1 + (1 - bigDownbeatiness)*2.5 + (1 - smallDownbeatiness));
+      for(LeafLooper& ll : lls) {
+        ll.amplitudeExpansion = amplitudeExpansion;
+        ll.setBinRadii(1 + (1 - bigDownbeatiness)*2.5 + (1 - smallDownbeatiness));
+      }
 
     }
 
-    void setTrailLength(float t) {
+    void setTrailLength(const SectionCue& cue) {
       if(framesSinceLastBigSection < 7) {
-        if(bigSectionNum == 1 || bigSectionNum == 2 || bigSectionNum == 3 || bigSectionNum == 5 || bigSectionNum == 8 || bigSectionNum == 12) {
+        if(cue.clearsTrail) {
           // clearing after a big juncture
-          ll1.maxTrailLength = 5;
-          ll2.maxTrailLength = 5;
-        }
-      } else {
-        switch(bigSectionNum)
-        {
-          default:
-            ll1.setTrailLengthInSeconds(15);
-            ll2.setTrailLengthInSeconds(15);
-            break;
-          case 8:
-          case 9:
-          case 10:
-          case 11:
-            ll1.setTrailLengthInSeconds(30);
-            ll2.setTrailLengthInSeconds(30);
-            break;
+          for(LeafLooper& ll : lls) { ll.maxTrailLength = ll.trailPointsPerFrame; }
+          appliedTrailSeconds = 0;
         }
+      } else if(cue.trailSeconds != appliedTrailSeconds) {
+        for(LeafLooper& ll : lls) { ll.setTrailLengthInSeconds(cue.trailSeconds); }
+        appliedTrailSeconds = cue.trailSeconds;
       }
     }
 
     void setBeatsAndPhases(float t) {
       int oldBeatNum = beatNum, oldHyperbeatNum = hyperbeatNum, oldSmallSectionNum = smallSectionNum, oldBigSectionNum = bigSectionNum;
-      beatPhase = beatCycleLookup.getPhasePosition(t, beatNum);
-      hyperbeatPhase = hyperbeatCycleLookup.getPhasePosition(t, hyperbeatNum);
-      smallSectionPhase = smallSectionCycleLookup.getPhasePosition(t, smallSectionNum);
-      bigSectionPhase = bigSectionCycleLookup.getPhasePosition(t, bigSectionNum);
+      MetricalPosition position;
+      metricalHierarchy.getPosition(t, position);
+      beatPhase = position.phases[BEAT]; beatNum = position.cycleNums[BEAT];
+      hyperbeatPhase = position.phases[HYPERBEAT]; hyperbeatNum = position.cycleNums[HYPERBEAT];
+      smallSectionPhase = position.phases[SMALL_SECTION]; smallSectionNum = position.cycleNums[SMALL_SECTION];
+      bigSectionPhase = position.phases[BIG_SECTION]; bigSectionNum = position.cycleNums[BIG_SECTION];
       if (oldBeatNum != beatNum) { framesSinceLastBeat = 0; } else { framesSinceLastBeat++; }
       if (oldHyperbeatNum != hyperbeatNum) { framesSinceLastHyperBeat = 0; } else { framesSinceLastHyperBeat++; }
       if (oldSmallSectionNum != smallSectionNum) { framesSinceLastSmallSection = 0; } else { framesSinceLastSmallSection++; }
@@ -141,11 +132,59 @@ class Score {
     }
 
   private:
-    LeafLooper &ll1, &ll2;
+    // One SectionCue per big section (including before the first downbeat and after the last), worked out once,
+    // so that every frame is just a lookup of the current section plus whatever ramps it has
+    void compileTimeline() {
+      timeline.resize(bigSectionCycleLookup.numDownbeats() + 1);
+      for(int section = 0; section < int(timeline.size()); ++section) {
+        SectionCue& cue = timeline[section];
+        switch(section)
+        {
+          default:
+            cue.holdColors(Color(0.9375, 0.9375, 0.3125), Color(0.39375, 0.875, 0.538125));
+            break;
+          case 2:
+            cue.holdColors(Color(0.9375, 0.5, 0.3125), Color(0.8375, 0.7, 0.1125));
+            break;
+          case 3:
+            cue.holdColors(Color(0, 0.979167, 0.391667), Color(0.9375, 0.907812, 0.640625));
+            break;
+          case 4:
+            cue.holdColors(Color(0.9375, 0.9375, 0.3125), Color(0.39375, 0.875, 0.538125));
+            break;
+          case 5:
+            cue.holdColors(Color(0.9375, 0.5, 0.3125), Color(0.8375, 0.7, 0.1125));
+            break;
+          case 6:
+            cue.rampColors(Color(0.9375, 0.5, 0.3125), Color(0, 0.685416, 0.979167), Color(0.8375, 0.7, 0.1125), Color(0.7, 0, 1.0));
+            cue.rampNavHeight(-3.0, -10.0);
+            break;
+          case 7:
+            cue.rampColors(Color(0, 0.685416, 0.979167), Color(0.979167, 0.0979166, 0), Color(0.7, 0, 1.0), Color(1, 0.47, 0.116667));
+            cue.rampNavHeight(-10.0, -3.0);
+            break;
+          case 8:
+            cue.holdColors(Color(0.979167, 0.0979166, 0), Color(1, 0.47, 0.116667));
+            break;
+          case 9:
+            cue.holdColors(Color(0.9375, 0.5, 0.3125), Color(0.9375, 0.5, 0.3125));
+            break;
+        }
+        cue.trailSeconds = (section >= 8 && section <= 11) ? 30 : 15;
+        cue.clearsTrail = section == 1 || section == 2 || section == 3 || section == 5 || section == 8 || section == 12;
+      }
+    }
+
+    std::vector<SectionCue> timeline;
+    int appliedSection = -1;  // the big section setFromTime last applied
+    float appliedTrailSeconds = -1;  // the trail length we last gave the loopers (0 while clearing)
+
+    LeafLooperPool& lls;
     MeterMaid &beatCycleLookup, &hyperbeatCycleLookup, &smallSectionCycleLookup, &bigSectionCycleLookup;
+    MetricalHierarchy metricalHierarchy;
     float &horizontalMotionRadius, &verticalMotionRadius, &turnSpeed;
     Nav& nav;
-    int beatNum, hyperbeatNum, smallSectionNum, bigSectionNum;
+    int beatNum = -1, hyperbeatNum = -1, smallSectionNum = -1, bigSectionNum = -1;
     int framesSinceLastBeat = 0, framesSinceLastHyperBeat = 0, framesSinceLastSmallSection = 0, framesSinceLastBigSection = 0;
     float beatPhase, hyperbeatPhase, smallSectionPhase, bigSectionPhase;
 };
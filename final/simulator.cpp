@@ -6,22 +6,22 @@
 #define ANALYSIS_SOUND_FILE_NAME ("EvansLeafLoopsDryDPA.ogg")
 #define PLAYBACK_SOUND_FILE_NAME ("EvansLeafLoopsFinal.ogg")
 #define SAMPLE_RATE (48000)
-#define FFT_SIZE (1024)
-#define REDUNDANCY (5)
-#define VISUAL_DECAY (0.8)
-#define MIN_DIST (5)
 
 #include <cassert>
 #include <iostream>
 #include <algorithm>
-#include "Gamma/SamplePlayer.h"
+#include "Gamma/Sync.h"
 #include "Gamma/DFT.h"
 #include "common.hpp"
 #include "utilityFunctions.hpp"
 #include "leafOscillators.hpp"
 #include "leafLooper.hpp"
+#include "leafLooperPool.hpp"
 #include "meterMaid.hpp"
 #include "score.hpp"
+#include "llMotion.hpp"
+#include "spectralCache.hpp"
+#include "soundStreams.hpp"
 #include "alloutil/al_AlloSphereAudioSpatializer.hpp"
 #include "alloutil/al_Simulator.hpp"
 using namespace al;
@@ -45,8 +45,6 @@ using namespace gam;
 // Middle ground: extrude as a structure over space
 
 
-CombinedLeafOscillator ll1ComboOscillator(ivyOscillator, birchOscillator);
-CombinedLeafOscillator ll2ComboOscillator(ivyOscillator, birchOscillator);
 CombinedLeafOscillator ll1HorizontalMotionComboOscillator(ivyOscillator, birchOscillator);
 CombinedLeafOscillator ll2HorizontalMotionComboOscillator(ivyOscillator, birchOscillator);
 CombinedLeafOscillator ll1VerticalMotionComboOscillator(ivyOscillator, birchOscillator);
@@ -111,50 +109,17 @@ struct LeafLoopsWidgets {
   }
 };
 
-struct LLMotion
-{
-  float horizontalRadiusMul, verticalRadiusMul;
-  MeterMaid horizonalDownbeatPhasor, verticalDownbeatPhasor;
-  CombinedLeafOscillator horizonalLeafOscillator, verticalLeafOscillator;
-
-  LLMotion(MeterMaid& _horizonalDownbeatsPhasor, MeterMaid& _verticalDownbeatsPhasor, float _horizontalRadiusMul, float _verticalRadiusMul)
-   : horizonalDownbeatPhasor(_horizonalDownbeatsPhasor), 
-   verticalDownbeatPhasor(_verticalDownbeatsPhasor),
-   horizontalRadiusMul(_horizontalRadiusMul),
-   verticalRadiusMul(_verticalRadiusMul),
-   horizonalLeafOscillator(ivyOscillator, birchOscillator),
-   verticalLeafOscillator(ivyOscillator, birchOscillator)
-  {
-    horizonalLeafOscillator.setWeighting(0.7);
-    verticalLeafOscillator.setWeighting(0.0);
-  }
-
-  Vec3f getPosition(float t) {
-    float hAngle = horizonalLeafOscillator.getAngle(horizonalDownbeatPhasor.getPhasePosition(t));
-    float hRadius = horizonalLeafOscillator.getRadius(horizonalDownbeatPhasor.getPhasePosition(t));
-    float vAngle = verticalLeafOscillator.getAngle(verticalDownbeatPhasor.getPhasePosition(t));
-    float vRadius = verticalLeafOscillator.getRadius(verticalDownbeatPhasor.getPhasePosition(t));
-
-    float goalX = cos(hAngle) * hRadius * horizontalRadiusMul * (0.9 + pow(sin(horizonalDownbeatPhasor.getPhasePosition(t)*M_PI), 2));
-    float goalY = sin(vAngle) * vRadius * verticalRadiusMul * (0.9 + pow(sin(verticalDownbeatPhasor.getPhasePosition(t)*M_PI), 2));
-    float goalZ = -sin(hAngle) * cos(vAngle) * vRadius * hRadius * verticalRadiusMul;
-    float horizontalDist = hypot(goalX, goalZ);
-    if(horizontalDist < MIN_DIST) { // ensure it doesn't get too close
-        goalX *= MIN_DIST / horizontalDist;
-        goalZ *= MIN_DIST / horizontalDist;
-    }
-    return Vec3d(goalX, goalY, goalZ);
-  }
-};
-
 struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient {
 
   State state;
   cuttlebone::Maker<State> maker;
 
-  SamplePlayer<> anaylsisPlayer, playbackPlayer;
+  SoundStreams soundStreams;  // the analysis and playback soundfiles, streamed off the disk in step
+  int analysisStream, playbackStream;
+  double transportFrame = 0;  // the transport as of this graphics frame, so everything in onAnimate agrees on the time
+  SpectralCache spectralCache;  // the analysis soundfile's spectra worked out ahead of time, if they have been
   bool paused = false, doOneFrame = false;
-  LeafLooper ll1, ll2;
+  LeafLooperPool lls;  // one per channel of the analysis soundfile
 
   MeterMaid beatCycleLookup, hyperbeatCycleLookup, smallSectionCycleLookup, bigSectionCycleLookup;
   Score score;
@@ -162,6 +127,7 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
   LLMotion llMotion;
 
   bool firstDrawDone = false;
+  ShaderProgram fadingShader;  // fades the leaf loopers' strips by their age
   bool turning = true;
   float turnSpeed = 0.001;
 
@@ -170,26 +136,32 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
   LeafLoops() 
     : maker(Simulator::defaultBroadcastIP()),
       InterfaceServerClient(Simulator::defaultInterfaceServerIP()),
-      ll1(ll1ComboOscillator, Color(0.9375, 0.9375, 0.3125)), 
-      ll2(ll2ComboOscillator, Color(0.39375, 0.875, 0.538125)),
       beatCycleLookup("LeafLoopsDownbeats.txt"),
       hyperbeatCycleLookup("LeafLoopsHyperDownbeats.txt"),
       smallSectionCycleLookup("LeafLoopsSectionDownbeats.txt"),
       bigSectionCycleLookup("LeafLoopsBigSectionDownbeats.txt"),
       llMotion(smallSectionCycleLookup, bigSectionCycleLookup, 6.0, 4.5),
-      score(ll1, ll2, nav(), beatCycleLookup, hyperbeatCycleLookup, smallSectionCycleLookup, 
+      score(lls, nav(), beatCycleLookup, hyperbeatCycleLookup, smallSectionCycleLookup, 
         bigSectionCycleLookup, llMotion.horizontalRadiusMul, llMotion.verticalRadiusMul, turnSpeed) 
     {
-    anaylsisPlayer.load(fullPathOrDie(ANALYSIS_SOUND_FILE_NAME).c_str());
-    anaylsisPlayer.pos(FFT_SIZE); // give the analysisPlayer a headstart of FFT_SIZE, to compensate for the lag in analysis
-    playbackPlayer.load(fullPathOrDie(PLAYBACK_SOUND_FILE_NAME).c_str());
+    string analysisFilePath = fullPathOrDie(ANALYSIS_SOUND_FILE_NAME);
+    analysisStream = soundStreams.add(analysisFilePath, FFT_SIZE); // give the analysis a headstart of FFT_SIZE, to compensate for the lag in analysis
+    // made by spectralCacheBuilder; without it we fall back to the STFT in onSound
+    if(spectralCache.open(spectralCachePathFor(analysisFilePath), FFT_SIZE, FFT_SIZE/2, soundStreams.frames(analysisStream))) {
+      cout << "Using the spectral cache for " << ANALYSIS_SOUND_FILE_NAME << endl;
+    }
+    playbackStream = soundStreams.add(fullPathOrDie(PLAYBACK_SOUND_FILE_NAME));
+    if(soundStreams.frameRate(analysisStream) != SAMPLE_RATE || soundStreams.frameRate(playbackStream) != SAMPLE_RATE) {
+      cout << "WARNING: the soundfiles aren't at " << SAMPLE_RATE << "Hz, but get played at that rate anyway" << endl;
+    }
+    lls.create(soundStreams.channels(analysisStream), state);
     initWindow(Window::Dim(900, 600), "Leaf Loops");
     nav().pos(0, -3.0, 0);
     nav().faceToward(Vec3d(0, -3.0, -1), Vec3d(0, 1, 0));
-    ll1.p.pos(0, 0, -3);
-    ll1.p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
-    ll2.p.pos(0, 0, 3);
-    ll2.p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
+    for(int i = 0; i < lls.size(); ++i) {
+      lls[i].p.pos(LLMotion::spreadPosition(Vec3f(0, 0, -3), i, lls.size()));
+      lls[i].p.faceToward(Vec3d(0, 0, 0), Vec3d(0, 1, 0));
+    }
 
     paused = false;
 
@@ -199,12 +171,13 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
     AlloSphereAudioSpatializer::initSpatialization();
     // if gamma
     gam::Sync::master().spu(AlloSphereAudioSpatializer::audioIO().fps());
-    scene()->addSource(ll1);
-    ll1.dopplerType(DOPPLER_NONE);
-    scene()->addSource(ll2);
-    ll2.dopplerType(DOPPLER_NONE);
+    for(LeafLooper& ll : lls) {
+      scene()->addSource(ll);
+      ll.dopplerType(DOPPLER_NONE);
+    }
+    // the plain Vbap doesn't ramp its gains, so let the scene move the sources smoothly across each block
     scene()->usePerSampleProcessing(true);
-    // scene()->usePerSampleProcessing(false);
+    soundStreams.start(AlloSphereAudioSpatializer::audioIO().framesPerBuffer(), AlloSphereAudioSpatializer::audioIO().fps());
 
     // Connect GUI to window
     glvWidgets.gui.bindTo(window());
@@ -215,11 +188,18 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
 
     if (!paused || doOneFrame) {
       doOneFrame = false;
+      transportFrame = soundStreams.transport().frame();
       float measurePhase = beatCycleLookup.getPhasePosition(getTime());
       float hypermeasurePhase = hyperbeatCycleLookup.getPhasePosition(getTime());
 
-      ll1.pushNewStrip(measurePhase, hypermeasurePhase);
-      ll2.pushNewStrip(measurePhase, hypermeasurePhase);
+      double analysisPos = soundStreams.pos(analysisStream, transportFrame);
+      lls.forEach([&](LeafLooper& ll, int i) {
+        if(spectralCache.isOpen()) {
+          // the cache is keyed by how far into the soundfile the analysis has got, just like the real time STFT
+          ll.useCachedSpectrum(spectralCache.magnitudes(i, analysisPos));
+        }
+        ll.pushNewStrip(measurePhase, hypermeasurePhase);
+      });
 
       setLLPositions();
       score.setFromTime(getTime());
@@ -232,48 +212,30 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
   void checkGLVWidgets() {
     background(HSV(glvWidgets.bgColorPicker.getValue().components));
     state.bgColor = HSV(glvWidgets.bgColorPicker.getValue().components);
-    ll1.llColor = HSV(glvWidgets.ll1ColorPicker.getValue().components);
-    ll2.llColor = HSV(glvWidgets.ll2ColorPicker.getValue().components);
-    ll1.setBinRadii(glvWidgets.getLooperRadii());
-    ll2.setBinRadii(glvWidgets.getLooperRadii());
-    ll1.lfo.setWeighting(glvWidgets.ll1LeafType.getValue());
-    ll2.lfo.setWeighting(glvWidgets.ll2LeafType.getValue());
-    ll1.amplitudeExpansion = glvWidgets.getAmplitudeExpansion();
-    ll2.amplitudeExpansion = glvWidgets.getAmplitudeExpansion();
+    for(int i = 0; i < lls.size(); ++i) {
+      // the LL1 widgets go to the even loopers and the LL2 ones to the odd ones, like the score's colors
+      bool even = i % 2 == 0;
+      lls[i].llColor = HSV((even ? glvWidgets.ll1ColorPicker : glvWidgets.ll2ColorPicker).getValue().components);
+      lls[i].setBinRadii(glvWidgets.getLooperRadii());
+      lls[i].lfo.setWeighting((even ? glvWidgets.ll1LeafType : glvWidgets.ll2LeafType).getValue());
+      lls[i].amplitudeExpansion = glvWidgets.getAmplitudeExpansion();
+    }
   }
 
   void setLLPositions() {
-    Vec3f ll1Position = llMotion.getPosition(getTime());
-    Pose newGoal;
-    newGoal.pos(ll1Position);
-    newGoal.faceToward(Vec3d(0, 0, 0));
-    ll1.p = ll1.p.lerp(newGoal, 0.01);
-
-    newGoal.pos(-ll1Position);
-    newGoal.faceToward(Vec3d(0, 0, 0));
-    ll2.p = ll2.p.lerp(newGoal, 0.01);
-
+    llMotion.moveLoopers(lls, getTime());
     if (turning) { nav().turnU(turnSpeed); }
   }
 
+  // Seconds into the playback soundfile as of this graphics frame
   float getTime() {
-    return playbackPlayer.pos() / SAMPLE_RATE;
+    return soundStreams.pos(playbackStream, transportFrame) / SAMPLE_RATE;
   }
 
   void sendDataToCuttlebone() {
     // transfer the poses to the cuttlebone-friendly data structure of each leaf looper
-    ll1.llData.p = ll1.p;
-    ll2.llData.p = ll2.p;
-    ll1.llData.maxTrailLength = ll1.maxTrailLength;
-    ll2.llData.maxTrailLength = ll2.maxTrailLength;
-    ll1.llData.trailAlphaDecayFactor = ll1.trailAlphaDecayFactor;
-    ll2.llData.trailAlphaDecayFactor = ll2.trailAlphaDecayFactor;
-    ll1.llData.doTrail = ll1.doTrail;
-    ll2.llData.doTrail = ll2.doTrail;
-
-    // set those to cuttlebone-friendly data structures in the cuttlebone maker
-    state.llDatas[0] = ll1.llData;
-    state.llDatas[1] = ll2.llData;
+    for(LeafLooper& ll : lls) { ll.updateLLData(); }
+
     // increment framenum
     state.framenum++;
     state.navPose = nav();
@@ -282,31 +244,25 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
   }
 
   void onDraw(Graphics& g) override {
-    ll1.draw(g);
-    ll2.draw(g);
+    if(!firstDrawDone) {
+      // needs the GL context, so it can't happen in the constructor
+      fadingShader.compile(fadingVertexCode(), fadingFragmentCode());
+    }
+    for(LeafLooper& ll : lls) { ll.draw(g, fadingShader); }
     firstDrawDone = true;
   }
 
   void onSound(AudioIOData& io) override {
     if(!firstDrawDone || (paused && !doOneFrame)) { return; }
-    ll1.pose(ll1.p);
-    ll2.pose(ll2.p);
-    float mul1 = 1; //pow((nav().pos() - ll1.p.pos()).mag(), -2);
-    float mul2 = 1; //pow((nav().pos() - ll2.p.pos()).mag(), -2);
-    // cout << mul1 << ", " << mul2 << endl;
-    while (io()) {
-      for(int chan = 0; chan < 2; ++chan) {
-        float sampForAnalysis = anaylsisPlayer.read(chan);
-        float sampForPlayback = playbackPlayer.read(chan);
-        if(chan == 0) { ll1(sampForAnalysis); }
-        if(chan == 1) { ll2(sampForAnalysis); }
-
-        // if(chan == 0) { ll1.writeSample(sampForPlayback * mul1); }
-        // if(chan == 1) { ll2.writeSample(sampForPlayback * mul2); }
-        io.out(chan) = sampForPlayback;
-      }
-      anaylsisPlayer.advance();
-      playbackPlayer.advance();
+    for(LeafLooper& ll : lls) { ll.pose(ll.p); }
+    int numFrames = io.framesPerBuffer();
+    soundStreams.read(numFrames);
+    if(!spectralCache.isOpen()) {
+      // looper i analyses channel i
+      for(int i = 0; i < lls.size(); ++i) { lls[i].analyze(soundStreams.channel(analysisStream, i), numFrames); }
+    }
+    for(int chan = 0; chan < 2; ++chan) {
+      memcpy(io.outBuffer(chan), soundStreams.channel(playbackStream, chan % soundStreams.channels(playbackStream)), numFrames * sizeof(float));
     }
     listener()->pose(nav());
     // scene()->render(io);
@@ -320,21 +276,20 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
         paused = !paused;
         break;
       case '2':
-        anaylsisPlayer.pos(std::max(anaylsisPlayer.pos() - 10 * SAMPLE_RATE, 0.0));
-        playbackPlayer.pos(std::max(playbackPlayer.pos() - 10 * SAMPLE_RATE, 0.0));
+        // both soundfiles move together
+        soundStreams.seek(std::max(soundStreams.pos(playbackStream) - 10 * SAMPLE_RATE, 0.0));
         break;
       case '3':
-        anaylsisPlayer.pos(std::min(anaylsisPlayer.pos() + 10 * SAMPLE_RATE, double(anaylsisPlayer.frames())));
-        playbackPlayer.pos(std::min(playbackPlayer.pos() + 10 * SAMPLE_RATE, double(playbackPlayer.frames())));
+        soundStreams.seek(std::min(soundStreams.pos(playbackStream) + 10 * SAMPLE_RATE, double(soundStreams.frames(playbackStream))));
         break;
       case '4':
         doOneFrame = true;
         break;
       case '5':
-        ll1ComboOscillator.setWeighting(std::max(ll1ComboOscillator.weighting - 0.05, 0.0));
+        lls[0].lfo.setWeighting(std::max(lls[0].lfo.weighting - 0.05, 0.0));
         break;
       case '6':
-        ll1ComboOscillator.setWeighting(std::min(ll1ComboOscillator.weighting + 0.05, 1.0));
+        lls[0].lfo.setWeighting(std::min(lls[0].lfo.weighting + 0.05, 1.0));
         break;
       case '-':
         nav().pos(0, 20, 0);
@@ -345,8 +300,7 @@ struct LeafLoops : public App, AlloSphereAudioSpatializer, InterfaceServerClient
         nav().faceToward(Vec3d(0, -3.0, -1), Vec3d(0, 1, 0));
         break;
       case '0':
-        ll1.doTrail = !ll1.doTrail;
-        ll2.doTrail = !ll2.doTrail;
+        for(LeafLooper& ll : lls) { ll.doTrail = !ll.doTrail; }
         break;
       case 't':
         turning = !turning;
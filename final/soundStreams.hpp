@@ -0,0 +1,300 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Sound Streams
+  Plays soundfiles straight off the disk instead of decoding them all into memory up front. A background thread
+  decodes each file a chunk at a time into a ring buffer, and the audio thread reads a block of every file at once,
+  deinterleaved into one array per channel. The rings are single producer, single consumer, so the audio thread
+  never waits on a lock. All the files share one clock (a Transport): they always advance together, and a seek
+  moves all of them at the start of the same block, so the analysis and playback files stay sample locked.
+*/
+
+#ifndef __SOUND_STREAMS__
+#define __SOUND_STREAMS__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Gamma/SoundFile.h"
+#include "transport.hpp"
+
+#define MAX_SOUND_STREAMS (4)
+#define STREAM_CHUNK_FRAMES (2048)  // how much the decode thread reads at a time
+#define STREAM_RING_SECONDS (4.0)  // how far ahead of the audio thread it keeps each ring
+
+class SoundStreams {
+  public:
+    SoundStreams() {
+      for(int s = 0; s < MAX_SOUND_STREAMS; ++s) {
+        finishedStart[s] = 0;
+        finishedEnd[s] = 0;
+      }
+    }
+
+    ~SoundStreams() { stop(); }
+
+    // Opens a soundfile to stream, running startOffset frames ahead of the first one (e.g. the analysis file gets
+    // a head start of FFT_SIZE to make up for the lag in the analysis). Returns its stream number. Only before start
+    int add(std::string path, long long startOffset = 0) {
+      if(streams.size() == MAX_SOUND_STREAMS) {
+        fprintf(stderr, "ERROR: at most %d sound streams\n", MAX_SOUND_STREAMS);
+        exit(-1);
+      }
+      streams.emplace_back();
+      Stream& stream = streams.back();
+      if(!stream.file.openRead(path)) {
+        fprintf(stderr, "ERROR opening sound file \"%s\"\n", path.c_str());
+        exit(-1);
+      }
+      stream.offset = startOffset;
+      stream.numChannels = stream.file.channels();
+      stream.numFrames = stream.file.frames();
+      return int(streams.size()) - 1;
+    }
+
+    // Starts decoding from the beginning, for blocks of up to maxBlockFrames played at frameRate.
+    // Everything gets allocated here
+    void start(int _maxBlockFrames, double _frameRate, double ringSeconds = STREAM_RING_SECONDS) {
+      maxBlockFrames = _maxBlockFrames;
+      playbackRate = _frameRate;
+      int longestChunk = 0;
+      for(Stream& stream : streams) {
+        stream.ringFrames = 1;
+        while(stream.ringFrames < std::max(ringSeconds * stream.file.frameRate(), 2.0 * STREAM_CHUNK_FRAMES)) {
+          stream.ringFrames *= 2;
+        }
+        stream.ring.assign(stream.ringFrames * stream.numChannels, 0);
+        stream.block.assign(maxBlockFrames * stream.numChannels, 0);
+        longestChunk = std::max(longestChunk, STREAM_CHUNK_FRAMES * stream.numChannels);
+      }
+      chunk.resize(longestChunk);
+      requestedFrame = 0;
+      requestedSeeks++;
+      decoder = std::thread([this]() { decodeLoop(); });
+    }
+
+    void stop() {
+      stopping = true;
+      if(decoder.joinable()) { decoder.join(); }
+    }
+
+    int channels(int stream) const { return streams[stream].numChannels; }
+    long long frames(int stream) const { return streams[stream].numFrames; }
+    double frameRate(int stream) const { return streams[stream].file.frameRate(); }
+
+    // ANY THREAD
+    // The clock all the streams play to, in frames before any stream's offset
+    const Transport& transport() const { return clock; }
+
+    // ANY THREAD
+    // Where stream (counting its offset) is playing right now
+    double pos(int stream = 0) const { return pos(stream, clock.frame()); }
+
+    // Where stream is when the transport is at transportFrame, for reading the transport once and using it for everything
+    double pos(int stream, double transportFrame) const {
+      return std::min(transportFrame + streams[stream].offset, double(streams[stream].numFrames));
+    }
+
+    // ANY THREAD
+    // Moves every stream to frame (plus its offset). The audio carries on from where it was until there's
+    // something decoded at the new position, then all the streams switch over at the start of the same block
+    void seek(double frame) {
+      requestedFrame = (long long)(std::max(0.0, frame));
+      requestedSeeks++;
+    }
+
+    // AUDIO THREAD
+    // Reads the next n (at most maxBlockFrames) frames of every stream. Wherever decoding hasn't kept up, or past
+    // the end of a file, that stream gets silence, but time still moves on by n for all of them
+    void read(int n) {
+      takeFinishedSeek();
+      clock.publish(seekFrame + framesSinceSeek, n, playbackRate);
+      for(Stream& stream : streams) {
+        long long available = std::max(stream.written.load(std::memory_order_acquire), stream.knownWritten) - stream.readIndex;
+        int count = int(std::max(0LL, std::min(available, (long long)n)));
+        long long mask = stream.ringFrames - 1;
+        for(int c = 0; c < stream.numChannels; ++c) {
+          float* out = stream.block.data() + c * maxBlockFrames;
+          for(int i = 0; i < count; ++i) {
+            out[i] = stream.ring[((stream.readIndex + i) & mask) * stream.numChannels + c];
+          }
+          std::fill(out + count, out + n, 0.0f);
+        }
+        stream.readIndex += n;
+        stream.read.store(stream.readIndex, std::memory_order_release);
+      }
+      framesSinceSeek += n;
+    }
+
+    // AUDIO THREAD
+    // Channel c of stream's block from the last read
+    const float* channel(int stream, int c) const {
+      return streams[stream].block.data() + c * maxBlockFrames;
+    }
+
+  private:
+    struct Stream {
+      gam::SoundFile file;
+      long long offset = 0;
+      int numChannels = 0;
+      long long numFrames = 0;
+      std::vector<float> ring;  // interleaved; ring index i lives at frame i % ringFrames
+      long long ringFrames = 0;  // a power of two
+      std::atomic<long long> written{0};  // ring indices below this hold decoded audio (only the decode thread writes it)
+      std::atomic<long long> read{0};  // and the audio thread is done with the ones below this
+
+      // decode thread's
+      long long decodeIndex = 0;  // the next ring index to decode into
+      long long fileFrame = 0;  // the next frame of the file to decode
+      long long seekStart = 0;  // the ring index the seek being decoded starts at
+
+      // audio thread's
+      long long readIndex = 0;
+      long long knownWritten = 0;  // how much the seek we switched to had decoded, which written may not show yet
+      std::vector<float> block;  // channel c starts at c * maxBlockFrames
+    };
+
+    std::deque<Stream> streams;  // deques never move what's in them, which the atomics need
+    int maxBlockFrames = 0;
+    double playbackRate = 0;
+    std::thread decoder;
+    std::atomic<bool> stopping{false};
+    std::vector<float> chunk;  // decode thread's scratch
+
+    // seek requests, from any thread to the decode thread
+    std::atomic<long long> requestedFrame{0};
+    std::atomic<unsigned> requestedSeeks{0};
+
+    // Finished seeks, from the decode thread to the audio thread. The fields go together, so they're guarded by a
+    // sequence number (seqlock): odd while the decode thread is writing them, and the reader tries again if it changed
+    std::atomic<unsigned> finishedSequence{0};
+    std::atomic<unsigned> finishedGeneration{0};
+    std::atomic<long long> finishedFrame{0};
+    std::atomic<long long> finishedStart[MAX_SOUND_STREAMS], finishedEnd[MAX_SOUND_STREAMS];
+    std::atomic<unsigned> acknowledgedGeneration{0};  // the last one the audio thread switched to
+
+    // audio thread's
+    unsigned generation = 0;
+    long long seekFrame = 0, framesSinceSeek = 0;
+    Transport clock;  // published at every read, for everyone else
+
+    void takeFinishedSeek() {
+      unsigned sequence, newGeneration;
+      long long frame, starts[MAX_SOUND_STREAMS], ends[MAX_SOUND_STREAMS];
+      do {
+        sequence = finishedSequence.load(std::memory_order_acquire);
+        newGeneration = finishedGeneration.load(std::memory_order_relaxed);
+        frame = finishedFrame.load(std::memory_order_relaxed);
+        for(size_t s = 0; s < streams.size(); ++s) {
+          starts[s] = finishedStart[s].load(std::memory_order_relaxed);
+          ends[s] = finishedEnd[s].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+      } while((sequence & 1) || sequence != finishedSequence.load(std::memory_order_relaxed));
+      if(newGeneration == generation) { return; }
+
+      generation = newGeneration;
+      for(size_t s = 0; s < streams.size(); ++s) {
+        streams[s].readIndex = starts[s];
+        streams[s].knownWritten = ends[s];
+        streams[s].read.store(starts[s], std::memory_order_release);
+      }
+      seekFrame = frame;
+      framesSinceSeek = 0;
+      acknowledgedGeneration.store(generation, std::memory_order_release);
+    }
+
+    // DECODE THREAD from here down
+    void decodeLoop() {
+      unsigned handledSeeks = 0, decodedGeneration = 0;
+      bool seeking = false;
+      long long seekingTo = 0;
+      while(!stopping) {
+        unsigned seeks = requestedSeeks.load();
+        if(seeks != handledSeeks) {
+          handledSeeks = seeks;
+          seekingTo = requestedFrame.load();
+          for(Stream& stream : streams) {
+            // the new audio goes after everything decoded so far, which keeps playing until we're ready
+            stream.seekStart = stream.decodeIndex;
+            stream.fileFrame = std::max(0LL, std::min(seekingTo + stream.offset, stream.numFrames));
+            stream.file.seek(int(stream.fileFrame), SEEK_SET);
+          }
+          seeking = true;
+        }
+
+        bool caughtUp = decodedGeneration == acknowledgedGeneration.load(std::memory_order_acquire);
+        bool decodedAny = false;
+        bool allPrimed = true;
+        for(Stream& stream : streams) {
+          if(!seeking && caughtUp) { skipWhatWasMissed(stream); }
+          // until the audio thread switches over, it might still need everything from the last seek's start on
+          long long needed = stream.read.load(std::memory_order_acquire);
+          if(seeking || !caughtUp) { needed = std::min(needed, stream.seekStart); }
+          if(decodeChunk(stream, needed)) {
+            decodedAny = true;
+            if(!seeking) { stream.written.store(stream.decodeIndex, std::memory_order_release); }
+          }
+          allPrimed = allPrimed &&
+            (stream.decodeIndex - stream.seekStart >= STREAM_CHUNK_FRAMES || stream.fileFrame >= stream.numFrames);
+        }
+
+        if(seeking && allPrimed) {
+          decodedGeneration++;
+          finishedSequence.fetch_add(1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_release);
+          finishedGeneration.store(decodedGeneration, std::memory_order_relaxed);
+          finishedFrame.store(seekingTo, std::memory_order_relaxed);
+          for(size_t s = 0; s < streams.size(); ++s) {
+            finishedStart[s].store(streams[s].seekStart, std::memory_order_relaxed);
+            finishedEnd[s].store(streams[s].decodeIndex, std::memory_order_relaxed);
+          }
+          finishedSequence.fetch_add(1, std::memory_order_release);
+          for(Stream& stream : streams) { stream.written.store(stream.decodeIndex, std::memory_order_release); }
+          seeking = false;
+        }
+
+        if(!decodedAny) {
+          // all full (or at the end); the audio thread empties a chunk in a few tens of milliseconds
+          std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+      }
+    }
+
+    // If the audio thread ran past what we'd decoded, skip ahead to where it is, so the streams stay in time
+    void skipWhatWasMissed(Stream& stream) {
+      long long missed = stream.read.load(std::memory_order_acquire) - stream.decodeIndex;
+      if(missed <= 0) { return; }
+      stream.decodeIndex += missed;
+      stream.fileFrame = std::min(stream.fileFrame + missed, stream.numFrames);
+      stream.file.seek(int(stream.fileFrame), SEEK_SET);
+      stream.written.store(stream.decodeIndex, std::memory_order_release);
+    }
+
+    // Decodes up to a chunk into the ring, if there's room past needed (the oldest ring index still wanted)
+    bool decodeChunk(Stream& stream, long long needed) {
+      long long room = stream.ringFrames - (stream.decodeIndex - needed);
+      int count = int(std::min({ room, (long long)STREAM_CHUNK_FRAMES, stream.numFrames - stream.fileFrame }));
+      if(count <= 0) { return false; }
+      int got = stream.file.read(chunk.data(), count);
+      if(got <= 0) {
+        stream.fileFrame = stream.numFrames;  // treat a read error as the end
+        return false;
+      }
+      long long mask = stream.ringFrames - 1;
+      for(int i = 0; i < got; ++i) {
+        std::copy(chunk.data() + i * stream.numChannels, chunk.data() + (i + 1) * stream.numChannels,
+          stream.ring.data() + ((stream.decodeIndex + i) & mask) * stream.numChannels);
+      }
+      stream.decodeIndex += got;
+      stream.fileFrame += got;
+      return true;
+    }
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Spectral Cache
+  The analysis soundfile never changes, so its spectra can be worked out ahead of time (see spectralCacheBuilder.cpp)
+  instead of running an STFT in the audio callback on every performance. The cache file is a header followed by
+  one row of display-ready magnitudes per hop, every channel side by side, and gets memory mapped for playback.
+*/
+
+#ifndef __SPECTRAL_CACHE__
+#define __SPECTRAL_CACHE__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPECTRAL_CACHE_VERSION (1)
+
+// higher pow reduces visual decay time
+// multiplier gets it to roughly the right level
+// tanh squashes it between 0 and 1
+inline float displayMagnitude(float mag) {
+  return tanh(pow(mag, 1.3) * 1000.0);
+}
+
+struct SpectralCacheHeader {
+  char magic[4];  // "LLSC"
+  uint32_t version;
+  uint32_t fftSize, hopSize;
+  uint32_t numBins;  // per channel per hop; the Nyquist bin is left out, like everywhere else
+  uint32_t numChannels;
+  uint64_t numFrames;  // length of the soundfile it was made from, to catch a cache that has gone stale
+  uint64_t firstHopEnd;  // the first row's window ends after this many samples; each row after that is hopSize later
+  uint64_t numHops;
+};
+
+// Replaces the extension (if any) of a soundfile's path with .spectra
+inline std::string spectralCachePathFor(std::string soundFilePath) {
+  size_t dot = soundFilePath.find_last_of('.');
+  size_t slash = soundFilePath.find_last_of('/');
+  if(dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+    soundFilePath.erase(dot);
+  }
+  return soundFilePath + ".spectra";
+}
+
+class SpectralCache {
+  public:
+    SpectralCache() {}
+    ~SpectralCache() { close(); }
+
+    // Maps the cache at path, if there is one and it matches what we expect. Otherwise stays closed,
+    // and the caller should fall back to analysing in real time
+    bool open(std::string path, unsigned fftSize, unsigned numBins, uint64_t numFrames) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if(fd < 0) { return false; }
+      struct stat st;
+      if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SpectralCacheHeader)) {
+        ::close(fd);
+        return false;
+      }
+      void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);  // the mapping keeps the file around
+      if(mapped == MAP_FAILED) { return false; }
+      data = mapped;
+      mappedSize = st.st_size;
+      header = (const SpectralCacheHeader*)data;
+
+      const char* problem = NULL;
+      if(memcmp(header->magic, "LLSC", 4) != 0) { problem = "not a spectral cache"; }
+      else if(header->version != SPECTRAL_CACHE_VERSION) { problem = "made by a different version"; }
+      else if(header->fftSize != fftSize || header->numBins != numBins) { problem = "made with a different FFT size"; }
+      else if(header->numFrames != numFrames) { problem = "made from a different soundfile"; }
+      else if(header->numHops == 0 || header->hopSize == 0) { problem = "empty"; }
+      else if(mappedSize < sizeof(SpectralCacheHeader) + header->numHops * rowSize() * sizeof(float)) { problem = "truncated"; }
+      if(problem) {
+        fprintf(stderr, "Ignoring spectral cache \"%s\": %s\n", path.c_str(), problem);
+        close();
+        return false;
+      }
+      rows = (const float*)((const char*)data + sizeof(SpectralCacheHeader));
+      return true;
+    }
+
+    void close() {
+      if(data) { munmap(data, mappedSize); }
+      data = NULL;
+      header = NULL;
+      rows = NULL;
+      mappedSize = 0;
+    }
+
+    bool isOpen() const { return rows != NULL; }
+
+    // The magnitudes of the newest window that ends by the time samplesRead samples of the soundfile have gone
+    // into the analysis, i.e. what a real time STFT would be showing at that point. Safe to call from any thread
+    const float* magnitudes(int channel, double samplesRead) const {
+      uint64_t hop = 0;
+      if(samplesRead > header->firstHopEnd) {
+        hop = std::min(uint64_t(samplesRead - header->firstHopEnd) / header->hopSize, header->numHops - 1);
+      }
+      return rows + hop * rowSize() + channel * header->numBins;
+    }
+
+    unsigned numChannels() const { return header->numChannels; }
+
+  private:
+    void* data = NULL;
+    size_t mappedSize = 0;
+    const SpectralCacheHeader* header = NULL;
+    const float* rows = NULL;
+
+    size_t rowSize() const { return size_t(header->numBins) * header->numChannels; }
+};
+
+#endif
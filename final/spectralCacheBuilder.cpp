@@ -0,0 +1,94 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Spectral Cache Builder
+  Runs the same STFT the leaf loopers use over the whole analysis soundfile once, ahead of time,
+  and writes the magnitudes out as a spectral cache (see spectralCache.hpp) next to the soundfile.
+  Usage: spectralCacheBuilder [soundfile [cachefile]]
+  Build (and run on the analysis soundfile) like the simulators, from the AlloSystem root: ./run.sh mat201b/final/spectralCacheBuilder.cpp
+*/
+
+#define ANALYSIS_SOUND_FILE_NAME ("EvansLeafLoopsDryDPA.ogg")
+
+#include <iostream>
+#include <vector>
+#include "Gamma/DFT.h"
+#include "Gamma/SoundFile.h"
+#include "common.hpp"
+#include "spectralCache.hpp"
+#include "utilityFunctions.hpp"
+
+using namespace std;
+
+#define READ_CHUNK_FRAMES (8192)
+
+int main(int argc, char* argv[]) {
+  string soundFilePath = argc > 1 ? string(argv[1]) : fullPathOrDie(ANALYSIS_SOUND_FILE_NAME);
+  string cachePath = argc > 2 ? string(argv[2]) : spectralCachePathFor(soundFilePath);
+
+  gam::SoundFile soundFile(soundFilePath);
+  if(!soundFile.openRead()) {
+    fprintf(stderr, "ERROR opening soundfile \"%s\"\n", soundFilePath.c_str());
+    return -1;
+  }
+  int numChannels = soundFile.channels();
+  uint64_t numFrames = soundFile.frames();
+
+  // one STFT per channel, set up just like LeafLooper's
+  vector<gam::STFT*> stfts;
+  for(int chan = 0; chan < numChannels; ++chan) {
+    stfts.push_back(new gam::STFT(FFT_SIZE, FFT_SIZE/4, 0, gam::HANN, gam::COMPLEX));
+  }
+
+  SpectralCacheHeader header;
+  memcpy(header.magic, "LLSC", 4);
+  header.version = SPECTRAL_CACHE_VERSION;
+  header.fftSize = FFT_SIZE;
+  header.hopSize = stfts[0]->sizeHop();
+  header.numBins = FFT_SIZE/2;
+  header.numChannels = numChannels;
+  header.numFrames = numFrames;
+  header.firstHopEnd = 0;
+  header.numHops = 0;
+
+  FILE* out = fopen(cachePath.c_str(), "wb");
+  if(!out) {
+    fprintf(stderr, "ERROR opening \"%s\" for writing\n", cachePath.c_str());
+    return -1;
+  }
+  // the header goes in once more at the end, when we know how many hops there were
+  fwrite(&header, sizeof(header), 1, out);
+
+  vector<float> chunk(READ_CHUNK_FRAMES * numChannels);
+  vector<float> row(header.numBins * numChannels);
+  uint64_t framesRead = 0;
+  while(framesRead < numFrames) {
+    int framesInChunk = soundFile.read(chunk.data(), READ_CHUNK_FRAMES);
+    if(framesInChunk <= 0) { break; }
+    for(int i = 0; i < framesInChunk; ++i) {
+      // every channel's STFT fires on the same sample, since they all started together
+      bool hopDone = false;
+      for(int chan = 0; chan < numChannels; ++chan) {
+        if((*stfts[chan])(chunk[i * numChannels + chan])) {
+          hopDone = true;
+          for(unsigned k = 0; k < header.numBins; ++k) {
+            row[chan * header.numBins + k] = displayMagnitude(stfts[chan]->bin(k).mag());
+          }
+        }
+      }
+      if(hopDone) {
+        if(header.numHops == 0) { header.firstHopEnd = framesRead + i + 1; }
+        fwrite(row.data(), sizeof(float), row.size(), out);
+        header.numHops++;
+      }
+    }
+    framesRead += framesInChunk;
+  }
+
+  rewind(out);
+  fwrite(&header, sizeof(header), 1, out);
+  fclose(out);
+  for(gam::STFT* stft : stfts) { delete stft; }
+
+  cout << "Wrote " << header.numHops << " hops of " << numChannels << " channels to " << cachePath << endl;
+  return 0;
+}
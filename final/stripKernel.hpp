@@ -0,0 +1,98 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Strip Kernel
+  Generates the vertices of a radial strip, straight into the strip's storage. The inputs are plain float arrays
+  and the loop has no calls or branches in it, so the compiler can vectorize it.
+*/
+
+#ifndef __STRIP_KERNEL__
+#define __STRIP_KERNEL__
+
+#include <cmath>
+#include <cstdint>
+#include "allocore/al_Allocore.hpp"
+
+#define RANDOM_LANES (8)
+
+// A xorshift generator per lane. Each lane only depends on itself, so filling a block
+// of numbers vectorizes, unlike a single global generator
+struct LaneRandom {
+  uint32_t state[RANDOM_LANES];
+
+  LaneRandom(uint32_t seed = 1) { setSeed(seed); }
+
+  void setSeed(uint32_t seed) {
+    for(int lane = 0; lane < RANDOM_LANES; ++lane) {
+      // splitmix-style scramble, so neighbouring seeds and lanes don't start out correlated
+      uint32_t x = seed + 0x9E3779B9u * (lane + 1);
+      x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+      x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+      x ^= x >> 16;
+      state[lane] = x ? x : 1;  // xorshift gets stuck on zero
+    }
+  }
+
+  // Fills out with uniform numbers in [-1, 1), like rnd::uniformS
+  void uniformS(float* out, int n) {
+    int i = 0;
+    for(; i + RANDOM_LANES <= n; i += RANDOM_LANES) {
+      for(int lane = 0; lane < RANDOM_LANES; ++lane) {
+        out[i + lane] = next(lane);
+      }
+    }
+    for(int lane = 0; i < n; ++i, ++lane) {
+      out[i] = next(lane);
+    }
+  }
+
+  private:
+    float next(int lane) {
+      uint32_t x = state[lane];
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      state[lane] = x;
+      return (x >> 8) * (2.0f / 16777216.0f) - 1.0f;  // top 24 bits, scaled to [-1, 1)
+    }
+};
+
+// sin and cos together, to about 1e-6. Reduces x to within pi/4 of a multiple of pi/2 and uses short
+// Taylor polynomials there, then picks and flips the results by quadrant
+inline void fastSinCos(float x, float& s, float& c) {
+  float quadrant = std::floor(x * float(2 / M_PI) + 0.5f);
+  float r = (x - quadrant * 1.5703125f) - quadrant * float(M_PI / 2 - 1.5703125);  // two steps, to keep precision
+  float r2 = r * r;
+  float sinR = r * (1 - r2 * (1.0f/6 - r2 * (1.0f/120 - r2 * (1.0f/5040))));
+  float cosR = 1 - r2 * (0.5f - r2 * (1.0f/24 - r2 * (1.0f/720 - r2 * (1.0f/40320))));
+  int q = int(quadrant) & 3;
+  float sinOut = (q & 1) ? cosR : sinR;
+  float cosOut = (q & 1) ? sinR : cosR;
+  s = (q & 2) ? -sinOut : sinOut;
+  c = ((q + 1) & 2) ? -cosOut : cosOut;
+}
+
+template <int NUM_BINS>
+struct StripKernel {
+  // scratch for the random displacements, kept around so nothing gets allocated per strip
+  float jitter[NUM_BINS], jitter2[NUM_BINS];
+
+  // Writes one strip vertex per bin into out. Each bin sits at binRadii[i] * radiusMul, at angles angle and angle2,
+  // with each angle randomly displaced by up to expansion * magnitudes[i]
+  void generate(const float* binRadii, const float* magnitudes, float radiusMul, float angle, float angle2,
+    float expansion, LaneRandom& random, al::Vec3f* out)
+  {
+    random.uniformS(jitter, NUM_BINS);
+    random.uniformS(jitter2, NUM_BINS);
+
+    for(int i = 0; i < NUM_BINS; ++i) {
+      float radius = binRadii[i] * radiusMul;
+      float spread = expansion * magnitudes[i];
+      float sinA, cosA, sinA2, cosA2;
+      fastSinCos(angle + jitter[i] * spread, sinA, cosA);
+      fastSinCos(angle2 + jitter2[i] * spread, sinA2, cosA2);
+      out[i] = al::Vec3f(cosA2 * radius, cosA * sinA2 * radius, -sinA * radius);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Transport
+  The one clock everything else follows. Once per block the audio thread publishes which frame that block starts at,
+  along with when it did so, and anyone can read it back without ever holding up the audio thread. Between blocks the
+  readers carry the frame on at the frame rate from that timestamp, so the graphics move smoothly instead of in block
+  sized steps, but never further than the block that was published, so it stops along with the audio.
+*/
+
+#ifndef __TRANSPORT__
+#define __TRANSPORT__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+class Transport {
+  public:
+    // AUDIO THREAD
+    // The block about to play starts at frame and runs for blockFrames
+    void publish(long long frame, int blockFrames, double frameRate) {
+      long long now = nanoseconds();
+      // a sequence number (seqlock), odd while we're writing, so readers never see half of one block and half of another
+      sequence.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      publishedFrame.store(frame, std::memory_order_relaxed);
+      publishedFrames.store(blockFrames, std::memory_order_relaxed);
+      publishedRate.store(frameRate, std::memory_order_relaxed);
+      publishedAt.store(now, std::memory_order_relaxed);
+      sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    // ANY THREAD
+    // The frame playing right now. Read it once per graphics frame and use that everywhere, so it all agrees
+    double frame() const {
+      long long frame, at;
+      int blockFrames;
+      double frameRate;
+      read(frame, blockFrames, frameRate, at);
+      double elapsed = (nanoseconds() - at) * 1e-9 * frameRate;
+      return frame + std::max(0.0, std::min(elapsed, double(blockFrames)));
+    }
+
+  private:
+    std::atomic<unsigned> sequence{0};
+    std::atomic<long long> publishedFrame{0};
+    std::atomic<int> publishedFrames{0};
+    std::atomic<double> publishedRate{0};
+    std::atomic<long long> publishedAt{0};
+
+    static long long nanoseconds() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Only goes round again if a block gets published in the middle, and a read is over long before the next one
+    void read(long long& frame, int& blockFrames, double& frameRate, long long& at) const {
+      unsigned before;
+      do {
+        before = sequence.load(std::memory_order_acquire);
+        frame = publishedFrame.load(std::memory_order_relaxed);
+        blockFrames = publishedFrames.load(std::memory_order_relaxed);
+        frameRate = publishedRate.load(std::memory_order_relaxed);
+        at = publishedAt.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+      } while((before & 1) || before != sequence.load(std::memory_order_relaxed));
+    }
+};
+
+#endif
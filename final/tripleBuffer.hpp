@@ -0,0 +1,58 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Triple Buffer
+  Lock-free handoff of the latest value from one writer thread (e.g. audio) to one reader thread (e.g. graphics).
+  The writer fills a back buffer and publishes it; the reader always gets the newest complete value, never a torn one,
+  and neither side ever waits for the other.
+*/
+
+#ifndef __TRIPLE_BUFFER__
+#define __TRIPLE_BUFFER__
+
+#include <atomic>
+#include <cstdint>
+
+template <class T>
+class TripleBuffer {
+  public:
+    TripleBuffer() {}
+
+    // WRITER SIDE
+    // The buffer to fill in; nobody else looks at it until publish()
+    T& back() { return buffers[backIndex]; }
+
+    // Hands the back buffer over to the reader. If the reader never picked up the previously
+    // published value, that one gets overwritten and counted as dropped
+    void publish() {
+      uint8_t old = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+      if(old & FRESH) { droppedFrames.fetch_add(1, std::memory_order_relaxed); }
+      backIndex = old & INDEX_MASK;
+    }
+
+    // READER SIDE
+    // Picks up the newest published value, if there is one since last time. Returns whether there was
+    bool update() {
+      if(!(middle.load(std::memory_order_relaxed) & FRESH)) { return false; }
+      uint8_t old = middle.exchange(frontIndex, std::memory_order_acq_rel);
+      frontIndex = old & INDEX_MASK;
+      return true;
+    }
+
+    // The newest value as of the last update(); stays put until the next one
+    const T& front() const { return buffers[frontIndex]; }
+
+    // Values the reader never got to see because a newer one replaced them first
+    uint64_t dropped() const { return droppedFrames.load(std::memory_order_relaxed); }
+
+  private:
+    static const uint8_t INDEX_MASK = 3;
+    static const uint8_t FRESH = 4;  // set on the middle index while it holds a value the reader hasn't taken
+
+    T buffers[3];
+    uint8_t backIndex = 0;   // only touched by the writer
+    std::atomic<uint8_t> middle{1};
+    uint8_t frontIndex = 2;  // only touched by the reader
+    std::atomic<uint64_t> droppedFrames{0};
+};
+
+#endif
@@ -7,26 +7,126 @@
 #define __UTILITIES__
 
 #include "allocore/al_Allocore.hpp"
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#define FLOAT_DATA_VERSION (1)
 
-std::string fullPathOrDie(std::string fileName, std::string whereToLook = ".") {
+// Guards the caches below, in case anything gets loaded off the main thread
+inline std::mutex& dataFilesMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Where fileName is, or "" if it isn't anywhere we look. Each file only gets searched for once
+inline std::string findFile(std::string fileName, std::string whereToLook = ".") {
+  static std::map<std::string, std::string> foundPaths;
+  std::lock_guard<std::mutex> lock(dataFilesMutex());
+  std::string key = whereToLook + "\n" + fileName;
+  auto found = foundPaths.find(key);
+  if(found != foundPaths.end()) { return found->second; }
   al::SearchPaths searchPaths;
   searchPaths.addSearchPath(whereToLook);
-  searchPaths.print();
   std::string filePath = searchPaths.find(fileName).filepath();
+  foundPaths[key] = filePath;
+  return filePath;
+}
+
+inline std::string fullPathOrDie(std::string fileName, std::string whereToLook = ".") {
+  std::string filePath = findFile(fileName, whereToLook);
   if (filePath == "") {
-    fprintf(stderr, "ERROR loading file \"\" \n");
+    fprintf(stderr, "ERROR loading file \"%s\" \n", fileName.c_str());
     exit(-1);
   }
   return filePath;
 }
 
-void loadDownbeats(std::string pathToDataFile, std::vector<float>& downbeats) {
-  std::ifstream input(fullPathOrDie(pathToDataFile));
-  for( std::string line; getline( input, line ); ) {
-      downbeats.push_back(stof(line));
+// A list of floats loaded by loadFloats. Just a view: the numbers themselves are shared by everyone who
+// loaded the same file, and stay put for the whole run
+struct FloatArray {
+  const float* values = NULL;
+  size_t count = 0;
+
+  size_t size() const { return count; }
+  const float* begin() const { return values; }
+  const float* end() const { return values + count; }
+  const float& operator[](size_t i) const { return values[i]; }
+  const float& at(size_t i) const {
+    if(i >= count) { throw std::out_of_range("FloatArray::at"); }
+    return values[i];
   }
 };
 
-#endif
\ No newline at end of file
+// The binary version of a data file (see convertDataFiles.py): "LLFA", a version, a count,
+// then that many floats, little endian
+struct FloatDataHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+// Maps a binary data file read only, or returns false if it isn't one we can use
+inline bool mapFloatData(std::string path, FloatArray& out) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) { return false; }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FloatDataHeader)) {
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping keeps the file around
+  if(mapped == MAP_FAILED) { return false; }
+  const FloatDataHeader* header = (const FloatDataHeader*)mapped;
+  if(memcmp(header->magic, "LLFA", 4) != 0 || header->version != FLOAT_DATA_VERSION ||
+    st.st_size < (off_t)(sizeof(FloatDataHeader) + header->count * sizeof(float)))
+  {
+    fprintf(stderr, "Ignoring \"%s\": not a usable binary data file\n", path.c_str());
+    munmap(mapped, st.st_size);
+    return false;
+  }
+  out.values = (const float*)((const char*)mapped + sizeof(FloatDataHeader));
+  out.count = header->count;
+  return true;  // never unmapped; everything that loads data holds on to it until the end
+}
+
+// Loads a data file of floats, one per line, like LeafLoopsDownbeats.txt. If there is an up to date binary
+// version next to it (same name, .bin instead of .txt) that gets memory mapped instead of parsing the text.
+// Either way each file is only loaded once, and everyone asking for it shares the same numbers
+inline FloatArray loadFloats(std::string dataFileName) {
+  static std::map<std::string, FloatArray> loaded;
+  static std::deque<std::vector<float>> parsed;  // storage for the ones we had to read as text
+  std::string textPath = fullPathOrDie(dataFileName);
+
+  std::lock_guard<std::mutex> lock(dataFilesMutex());
+  auto found = loaded.find(textPath);
+  if(found != loaded.end()) { return found->second; }
+
+  FloatArray data;
+  std::string binaryPath = textPath.substr(0, textPath.find_last_of('.')) + ".bin";
+  struct stat textStat, binaryStat;
+  bool binaryUpToDate = stat(binaryPath.c_str(), &binaryStat) == 0 &&
+    (stat(textPath.c_str(), &textStat) != 0 || binaryStat.st_mtime >= textStat.st_mtime);
+  if(!binaryUpToDate || !mapFloatData(binaryPath, data)) {
+    parsed.emplace_back();
+    std::ifstream input(textPath);
+    for( std::string line; getline( input, line ); ) {
+        parsed.back().push_back(stof(line));
+    }
+    data.values = parsed.back().data();
+    data.count = parsed.back().size();
+  }
+  loaded[textPath] = data;
+  return data;
+}
+
+#endif
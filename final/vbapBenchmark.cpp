@@ -0,0 +1,210 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project VBAP Benchmark
+  Compares per sample VBAP (what usePerSampleProcessing(true) does) against RampedVbap's per block gains,
+  for rings of 2 to 54 speakers, with one source going around the listener. Also reports how far apart
+  the two come out, relative to the signal, to show the ramp isn't audibly different. Then does the same on the
+  AlloSphere's 3D layout, adding GridVbap, and checks GridVbap's gains against Vbap's with the listener turned
+  a few different ways.
+  Build and run like the simulators, from the AlloSystem root: ./run.sh mat201b/final/vbapBenchmark.cpp
+*/
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "allocore/al_Allocore.hpp"
+#include "rampedVbap.hpp"
+#include "gridVbap.hpp"
+
+using namespace al;
+using namespace std;
+
+#define SAMPLE_RATE (44100)
+#define BLOCK_SIZE (256)
+#define SECONDS (10)
+#define SECONDS_PER_REVOLUTION (4.0)  // a good deal faster than the loopers ever go
+
+const int SPEAKER_COUNTS[] = { 2, 4, 8, 16, 32, 54 };
+
+// numSpeakers evenly around the horizon (two speakers go at +-45, like the simulator's stereo layout)
+SpeakerLayout ringLayout(int numSpeakers) {
+  SpeakerLayout layout;
+  for(int i = 0; i < numSpeakers; ++i) {
+    float azimuth = numSpeakers == 2 ? (i == 0 ? 45 : -45) : 360.0 * i / numSpeakers - 180;
+    layout.addSpeaker(Speaker(i, azimuth, 0, 1.0, 1.0));
+  }
+  return layout;
+}
+
+// where the source is, relative to the listener, at frame
+Vec3d sourceDirection(long frame) {
+  double angle = 2 * M_PI * frame / (SECONDS_PER_REVOLUTION * SAMPLE_RATE);
+  return Vec3d(sin(angle), 0, -cos(angle));
+}
+
+// the same, but bobbing up and down as well, for the 3D layout
+Vec3d sphereSourceDirection(long frame) {
+  double angle = 2 * M_PI * frame / (SECONDS_PER_REVOLUTION * SAMPLE_RATE);
+  Vec3d direction(sin(angle), 0.8 * sin(angle * 0.37), -cos(angle));
+  return direction / direction.mag();
+}
+
+float sourceSample(long frame) {
+  return sin(2 * M_PI * 440 * frame / SAMPLE_RATE);
+}
+
+void clearOutputs(AudioIOData& io, int numSpeakers) {
+  for(int c = 0; c < numSpeakers; ++c) { memset(io.outBuffer(c), 0, BLOCK_SIZE * sizeof(float)); }
+}
+
+// Renders SECONDS of the moving source one way or the other. Returns the microseconds spent spatializing per block,
+// and leaves everything that came out of speaker c in rendered[c]
+double render(Spatializer& spatializer, bool perBlock, AudioIO& io, int numSpeakers, vector<vector<float>>& rendered,
+  Vec3d (*directionAt)(long) = sourceDirection)
+{
+  SoundSource source;
+  float samples[BLOCK_SIZE];
+  long numBlocks = long(SECONDS) * SAMPLE_RATE / BLOCK_SIZE;
+  rendered.assign(numSpeakers, vector<float>());
+  double microseconds = 0;
+  for(long block = 0; block < numBlocks; ++block) {
+    long firstFrame = block * BLOCK_SIZE;
+    for(int i = 0; i < BLOCK_SIZE; ++i) { samples[i] = sourceSample(firstFrame + i); }
+    clearOutputs(io, numSpeakers);
+
+    auto start = chrono::high_resolution_clock::now();
+    if(perBlock) {
+      Vec3d direction = directionAt(firstFrame + BLOCK_SIZE - 1);
+      spatializer.perform(io, source, direction, BLOCK_SIZE, samples);
+    } else {
+      for(int frameIndex = 0; frameIndex < BLOCK_SIZE; ++frameIndex) {
+        Vec3d direction = directionAt(firstFrame + frameIndex);
+        spatializer.perform(io, source, direction, BLOCK_SIZE, frameIndex, samples[frameIndex]);
+      }
+    }
+    microseconds += chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+
+    for(int c = 0; c < numSpeakers; ++c) {
+      rendered[c].insert(rendered[c].end(), io.outBuffer(c), io.outBuffer(c) + BLOCK_SIZE);
+    }
+  }
+  return microseconds / numBlocks;
+}
+
+// how far below the signal the difference between two renders is, in dB
+double differenceBelowSignal(vector<vector<float>>& reference, vector<vector<float>>& other) {
+  double signalPower = 0, differencePower = 0;
+  for(size_t c = 0; c < reference.size(); ++c) {
+    for(size_t i = 0; i < reference[c].size(); ++i) {
+      double difference = other[c][i] - reference[c][i];
+      signalPower += reference[c][i] * reference[c][i];
+      differencePower += difference * difference;
+    }
+  }
+  return -10 * log10(differencePower / signalPower);
+}
+
+// What comes out of each channel for a single sample of 1 from direction, one sample at a time like Vbap
+void gainsFrom(Spatializer& spatializer, AudioIO& io, int numChannels, Vec3d direction, vector<float>& gains) {
+  SoundSource source;
+  int frameIndex = 0;
+  float sample = 1;
+  clearOutputs(io, numChannels);
+  spatializer.perform(io, source, direction, BLOCK_SIZE, frameIndex, sample);
+  gains.resize(numChannels);
+  for(int c = 0; c < numChannels; ++c) { gains[c] = io.outBuffer(c)[0]; }
+}
+
+// Turns both listeners a few ways and compares GridVbap's gains to Vbap's all over the sphere. Above the top ring
+// and below the bottom one the speakers close off a flat cap that can be split into triplets more than one way, so
+// the two can fairly disagree there. Between the rings is the column that says whether GridVbap pans like Vbap
+void compareGains(Vbap& vbap, Listener& vbapListener, GridVbap& gridVbap, Listener& gridListener,
+  const SpeakerLayout& layout, AudioIO& io, int numChannels)
+{
+  float lowestRing = 90, highestRing = -90;
+  for(const Speaker& speaker : layout.speakers()) {
+    lowestRing = std::min(lowestRing, speaker.elevation);
+    highestRing = std::max(highestRing, speaker.elevation);
+  }
+  const int numOrientations = 5;
+  Quatd orientations[numOrientations] = { Quatd::identity(), Quatd().fromAxisAngle(M_PI / 2, Vec3d(0, 1, 0)),
+    Quatd().fromAxisAngle(M_PI, Vec3d(0, 1, 0)), Quatd().fromAxisAngle(0.6, Vec3d(1, 0, 0)),
+    Quatd().fromAxisAngle(2.0, Vec3d(1, 2, -1).normalize()) };
+  const char* orientationNames[numOrientations] = { "facing ahead  ", "turned left   ", "turned around ",
+    "tipped back   ", "turned askew  " };
+  cout << endl << "GridVbap against Vbap   largest gain difference   between the rings   mean" << endl;
+  vector<float> vbapGains, gridGains;
+  for(int o = 0; o < numOrientations; ++o) {
+    const Quatd& orientation = orientations[o];
+    vbapListener.pose(Pose(Vec3d(0, 0, 0), orientation));
+    gridListener.pose(Pose(Vec3d(0, 0, 0), orientation));
+    double largest = 0, largestBetweenRings = 0, total = 0;
+    int count = 0;
+    for(int elevation = -85; elevation <= 85; elevation += 5) {
+      for(int azimuth = 0; azimuth < 360; azimuth += 5) {
+        // pick the direction as the listener sees it, in Vbap's axes (x ahead, y left, z up), then turn it back out
+        double el = elevation * M_PI / 180, az = azimuth * M_PI / 180;
+        Vec3d seen(-sin(az) * cos(el), sin(el), -cos(az) * cos(el));
+        Vec3d direction = orientation.conj().rotate(seen);
+        gainsFrom(vbap, io, numChannels, direction, vbapGains);
+        gainsFrom(gridVbap, io, numChannels, direction, gridGains);
+        double difference = 0;
+        for(int c = 0; c < numChannels; ++c) { difference = std::max(difference, double(std::abs(gridGains[c] - vbapGains[c]))); }
+        largest = std::max(largest, difference);
+        if(elevation > lowestRing && elevation < highestRing) { largestBetweenRings = std::max(largestBetweenRings, difference); }
+        total += difference;
+        ++count;
+      }
+    }
+    cout << orientationNames[o] << "\t\t  " << largest << "\t\t      " << largestBetweenRings << "\t\t  "
+      << total / count << endl;
+  }
+}
+
+int main() {
+  cout << "speakers   per sample (us/block)   per block (us/block)   speedup   difference (dB below signal)" << endl;
+  for(int numSpeakers : SPEAKER_COUNTS) {
+    SpeakerLayout layout = ringLayout(numSpeakers);
+    AudioIO io(BLOCK_SIZE, SAMPLE_RATE, NULL, NULL, numSpeakers, 0);
+    AudioScene scene(BLOCK_SIZE);
+    Vbap vbap(layout);
+    RampedVbap rampedVbap(layout, false, BLOCK_SIZE);
+    scene.createListener(&vbap);
+    scene.createListener(&rampedVbap);
+
+    vector<vector<float>> perSampleOutput, perBlockOutput;
+    double perSampleTime = render(vbap, false, io, numSpeakers, perSampleOutput);
+    double perBlockTime = render(rampedVbap, true, io, numSpeakers, perBlockOutput);
+
+    cout << numSpeakers << "\t   " << perSampleTime << "\t\t\t   " << perBlockTime << "\t\t  "
+      << perSampleTime / perBlockTime << "\t    " << differenceBelowSignal(perSampleOutput, perBlockOutput) << endl;
+  }
+
+  cout << endl << "AlloSphere layout (3D)   us/block   speedup   difference (dB below signal)" << endl;
+  AlloSphereSpeakerLayout layout;
+  int numSpeakers = layout.numSpeakers();
+  int numChannels = 0;
+  for(const Speaker& speaker : layout.speakers()) { numChannels = std::max(numChannels, speaker.deviceChannel + 1); }
+  AudioIO io(BLOCK_SIZE, SAMPLE_RATE, NULL, NULL, numChannels, 0);
+  AudioScene scene(BLOCK_SIZE);
+  Vbap vbap(layout, true);
+  RampedVbap rampedVbap(layout, true, BLOCK_SIZE);
+  GridVbap gridVbap(layout, true, BLOCK_SIZE);
+  Listener* vbapListener = scene.createListener(&vbap);
+  scene.createListener(&rampedVbap);
+  Listener* gridListener = scene.createListener(&gridVbap);
+
+  vector<vector<float>> perSampleOutput, rampedOutput, gridOutput;
+  double perSampleTime = render(vbap, false, io, numChannels, perSampleOutput, sphereSourceDirection);
+  double rampedTime = render(rampedVbap, true, io, numChannels, rampedOutput, sphereSourceDirection);
+  double gridTime = render(gridVbap, true, io, numChannels, gridOutput, sphereSourceDirection);
+  cout << "per sample Vbap           " << perSampleTime << endl;
+  cout << "RampedVbap                " << rampedTime << "\t      " << perSampleTime / rampedTime
+    << "\t" << differenceBelowSignal(perSampleOutput, rampedOutput) << endl;
+  cout << "GridVbap                  " << gridTime << "\t      " << perSampleTime / gridTime
+    << "\t" << differenceBelowSignal(perSampleOutput, gridOutput) << endl;
+  cout << "(" << numSpeakers << " speakers)" << endl;
+
+  compareGains(vbap, *vbapListener, gridVbap, *gridListener, layout, io, numChannels);
+}
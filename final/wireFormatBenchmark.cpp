@@ -0,0 +1,86 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Wire Format Benchmark
+  Compares the size and pack/unpack cost of full float strips (PseudoMesh) against quantized ones (CompactPseudoMesh).
+  The wire time is only an estimate, worked out from the size at LINK_BITS_PER_SECOND; nothing goes over a network
+  Build and run like the simulators, from the AlloSystem root: ./run.sh mat201b/final/wireFormatBenchmark.cpp
+*/
+
+#include <chrono>
+#include <iostream>
+#include "common.hpp"
+
+using namespace al;
+using namespace std;
+
+#define TRIALS (2000)
+#define BROADCASTS_PER_SECOND (60)
+#define LINK_BITS_PER_SECOND (1e9)  // assumed, for the wire time estimate
+
+Vec3f testVertices[FFT_SIZE];
+Color testColors[FFT_SIZE];
+
+template <class StripType>
+double microsecondsToPack(StripType& strip) {
+  auto start = chrono::high_resolution_clock::now();
+  for(int trial = 0; trial < TRIALS; ++trial) {
+    for(int i = 0; i < FFT_SIZE; ++i) {
+      strip.set(i, testVertices[i], testColors[(i + trial) % FFT_SIZE]);
+    }
+  }
+  return chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count() / TRIALS;
+}
+
+template <class StripType>
+double microsecondsToUnpack(StripType& strip, Mesh& mesh) {
+  auto start = chrono::high_resolution_clock::now();
+  for(int trial = 0; trial < TRIALS; ++trial) {
+    mesh.vertices().reset();
+    mesh.colors().reset();
+    for(int i = 0; i < FFT_SIZE; ++i) {
+      mesh.vertex(strip.vertex(i));
+      mesh.color(strip.color(i));
+    }
+  }
+  return chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count() / TRIALS;
+}
+
+void report(string name, size_t bytesPerLooper, double packTime, double unpackTime) {
+  double bytesPerBroadcast = double(bytesPerLooper) * MAX_LEAF_LOOPERS;
+  cout << name << ":" << endl;
+  cout << "  bytes per broadcast:   " << bytesPerBroadcast << endl;
+  cout << "  bandwidth (MB/s):      " << bytesPerBroadcast * BROADCASTS_PER_SECOND / 1e6 << endl;
+  cout << "  est. wire time (ms):   " << bytesPerBroadcast * 8 / LINK_BITS_PER_SECOND * 1000 << endl;
+  cout << "  pack per strip (us):   " << packTime << endl;
+  cout << "  unpack per strip (us): " << unpackTime << endl;
+}
+
+int main() {
+  for(int i = 0; i < FFT_SIZE; ++i) {
+    float radius = 4.0 * i / FFT_SIZE;
+    testVertices[i] = Vec3f(cos(i * 0.1) * radius, sin(i * 0.07) * radius, -sin(i * 0.1) * radius);
+    testColors[i] = Color(0.9375, 0.9375, 0.3125, float(i % 256) / 255);
+  }
+
+  PseudoMesh<FFT_SIZE>* fullStrip = new PseudoMesh<FFT_SIZE>;
+  CompactPseudoMesh<FFT_SIZE>* compactStrip = new CompactPseudoMesh<FFT_SIZE>;
+  Mesh mesh;
+
+  // the full format sends REDUNDANCY strips per looper, the compact one only the newest
+  report("Full (PseudoMesh x REDUNDANCY)", sizeof(PseudoMesh<FFT_SIZE>) * REDUNDANCY,
+    microsecondsToPack(*fullStrip), microsecondsToUnpack(*fullStrip, mesh));
+  report("Compact (CompactPseudoMesh x 1)", sizeof(CompactPseudoMesh<FFT_SIZE>),
+    microsecondsToPack(*compactStrip), microsecondsToUnpack(*compactStrip, mesh));
+
+  float maxPositionError = 0, maxAlphaError = 0;
+  for(int i = 0; i < FFT_SIZE; ++i) {
+    compactStrip->set(i, testVertices[i], testColors[i]);
+    maxPositionError = std::max(maxPositionError, (compactStrip->vertex(i) - testVertices[i]).mag());
+    maxAlphaError = std::max(maxAlphaError, std::abs(compactStrip->color(i).a - testColors[i].a));
+  }
+  cout << "Compact max position error: " << maxPositionError << endl;
+  cout << "Compact max alpha error:    " << maxAlphaError << endl;
+
+  delete fullStrip;
+  delete compactStrip;
+}
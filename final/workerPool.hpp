@@ -0,0 +1,94 @@
+/*
+  Marc Evans (2018/3/8)
+  Final Project Worker Pool
+  A few threads that stick around for the whole show, so fanning work out every frame only costs a wake up
+  instead of starting and joining threads. The thread that calls parallelFor does its share of the work too.
+*/
+
+#ifndef __WORKER_POOL__
+#define __WORKER_POOL__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+  public:
+    WorkerPool() {}
+
+    ~WorkerPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      for(std::thread& worker : workers) { worker.join(); }
+    }
+
+    // Starts numWorkers threads (besides whoever calls parallelFor). Only call once
+    void start(int numWorkers) {
+      for(int i = 0; i < numWorkers; ++i) {
+        workers.emplace_back([this]() { workerLoop(); });
+      }
+    }
+
+    // Calls f(i) for every i in [0, n) across the workers and this thread, and returns once they're all done.
+    // Nothing gets allocated, so it's fine to call every frame
+    template <class F>
+    void parallelFor(int n, F& f) {
+      if(workers.empty() || n <= 1) {
+        for(int i = 0; i < n; ++i) { f(i); }
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobFunction = [](void* context, int i) { (*(F*)context)(i); };
+        jobContext = &f;
+        jobSize = n;
+        nextIndex = 0;
+        busyWorkers = int(workers.size());
+        generation++;
+      }
+      wake.notify_all();
+      work();
+      std::unique_lock<std::mutex> lock(mutex);
+      finished.wait(lock, [this]() { return busyWorkers == 0; });
+    }
+
+  private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    bool stopping = false;
+    unsigned generation = 0;  // goes up by one for every parallelFor, which is how the workers know there's a new job
+    int busyWorkers = 0;
+
+    // the current job
+    void (*jobFunction)(void*, int) = NULL;
+    void* jobContext = NULL;
+    int jobSize = 0;
+    std::atomic<int> nextIndex{0};
+
+    void work() {
+      for(int i = nextIndex++; i < jobSize; i = nextIndex++) { jobFunction(jobContext, i); }
+    }
+
+    void workerLoop() {
+      unsigned lastGeneration = 0;
+      while(true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wake.wait(lock, [&]() { return stopping || generation != lastGeneration; });
+          if(stopping) { return; }
+          lastGeneration = generation;
+        }
+        work();
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--busyWorkers == 0) { finished.notify_one(); }
+      }
+    }
+};
+
+#endif